@@ -0,0 +1,162 @@
+#include "AsyncPlanner.h"
+#include "MapHandle.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <queue>
+#include <functional>
+#include <memory>
+using namespace std;
+
+class AsyncPlannerImpl
+{
+public:
+    AsyncPlannerImpl(const StreetMap* sm, const MapHandle* handle, int numThreads);
+    ~AsyncPlannerImpl();
+    future<RouteResult> generatePointToPointRoute(
+        const GeoCoord& start, const GeoCoord& end, const CancellationToken& token);
+    future<OrderResult> optimizeDeliveryOrder(
+        const GeoCoord& depot, const vector<DeliveryRequest>& deliveries, const CancellationToken& token);
+    future<PlanResult> generateDeliveryPlan(
+        const GeoCoord& depot, const vector<DeliveryRequest>& deliveries, const CancellationToken& token);
+private:
+    //the router, optimizer and planner keep no per-call state, so all workers share
+    //them. With a handle they come from whichever snapshot is current; the task holds
+    //its snapshot until it's done, which is what keeps that map alive.
+    shared_ptr<const MapSnapshot> m_fixed;
+    const MapHandle* m_handle;
+    shared_ptr<const MapSnapshot> snapshot() const { return m_handle != nullptr ? m_handle->snapshot() : m_fixed; }
+
+    vector<thread> m_workers;
+    queue<function<void()> > m_tasks;
+    mutex m_lock;
+    condition_variable m_wake;
+    bool m_stopping;
+
+    void workerLoop();
+    template<typename Result>
+    future<Result> submit(function<Result()> work);
+};
+
+AsyncPlannerImpl::AsyncPlannerImpl(const StreetMap* sm, const MapHandle* handle, int numThreads)
+ : m_handle(handle), m_stopping(false){
+    if(handle == nullptr)
+        m_fixed = make_shared<MapSnapshot>(sm, 0);
+    if(numThreads <= 0)
+        numThreads = max(1, (int)thread::hardware_concurrency());
+    for(int i = 0; i < numThreads; i++)
+        m_workers.push_back(thread(&AsyncPlannerImpl::workerLoop, this));
+}
+
+AsyncPlannerImpl::~AsyncPlannerImpl(){
+    {
+        lock_guard<mutex> guard(m_lock);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+    for(size_t i = 0; i < m_workers.size(); i++)
+        m_workers[i].join();
+}
+
+void AsyncPlannerImpl::workerLoop(){
+    for(;;){
+        function<void()> task;
+        {
+            unique_lock<mutex> guard(m_lock);
+            m_wake.wait(guard, [this]{ return m_stopping || !m_tasks.empty(); });
+            if(m_tasks.empty())
+                return;
+            task = move(m_tasks.front());
+            m_tasks.pop();
+        }
+        task();
+    }
+}
+
+template<typename Result>
+future<Result> AsyncPlannerImpl::submit(function<Result()> work){
+    //std::function needs a copyable callable, so the packaged_task is shared
+    shared_ptr<packaged_task<Result()> > task = make_shared<packaged_task<Result()> >(work);
+    future<Result> result = task->get_future();
+    {
+        lock_guard<mutex> guard(m_lock);
+        m_tasks.push([task]{ (*task)(); });
+    }
+    m_wake.notify_one();
+    return result;
+}
+
+future<RouteResult> AsyncPlannerImpl::generatePointToPointRoute(
+    const GeoCoord& start, const GeoCoord& end, const CancellationToken& token)
+{
+    return submit<RouteResult>([this, start, end, token]{
+        shared_ptr<const MapSnapshot> snap = snapshot();
+        RouteResult r;
+        RouteArena arena;
+        EdgePath path;
+        r.result = snap->router().generatePointToPointRoute(start, end, arena, path, r.distance, token);
+        r.edges.assign(path.begin(), path.end());
+        r.mapVersion = snap->version();
+        return r;
+    });
+}
+
+future<OrderResult> AsyncPlannerImpl::optimizeDeliveryOrder(
+    const GeoCoord& depot, const vector<DeliveryRequest>& deliveries, const CancellationToken& token)
+{
+    return submit<OrderResult>([this, depot, deliveries, token]{
+        shared_ptr<const MapSnapshot> snap = snapshot();
+        OrderResult r;
+        r.deliveries = deliveries;
+        r.complete = snap->optimizer().optimizeDeliveryOrder(depot, r.deliveries, r.oldCrowDistance, r.newCrowDistance, token);
+        return r;
+    });
+}
+
+future<PlanResult> AsyncPlannerImpl::generateDeliveryPlan(
+    const GeoCoord& depot, const vector<DeliveryRequest>& deliveries, const CancellationToken& token)
+{
+    return submit<PlanResult>([this, depot, deliveries, token]{
+        shared_ptr<const MapSnapshot> snap = snapshot();
+        PlanResult r;
+        r.result = snap->planner().generateDeliveryPlan(depot, deliveries, r.commands, r.distance, token);
+        return r;
+    });
+}
+
+//******************** AsyncPlanner functions *********************************
+
+// These functions simply delegate to AsyncPlannerImpl's functions.
+
+AsyncPlanner::AsyncPlanner(const StreetMap* sm, int numThreads)
+{
+    m_impl = new AsyncPlannerImpl(sm, nullptr, numThreads);
+}
+
+AsyncPlanner::AsyncPlanner(const MapHandle* handle, int numThreads)
+{
+    m_impl = new AsyncPlannerImpl(nullptr, handle, numThreads);
+}
+
+AsyncPlanner::~AsyncPlanner()
+{
+    delete m_impl;
+}
+
+future<RouteResult> AsyncPlanner::generatePointToPointRoute(
+    const GeoCoord& start, const GeoCoord& end, const CancellationToken& token)
+{
+    return m_impl->generatePointToPointRoute(start, end, token);
+}
+
+future<OrderResult> AsyncPlanner::optimizeDeliveryOrder(
+    const GeoCoord& depot, const vector<DeliveryRequest>& deliveries, const CancellationToken& token)
+{
+    return m_impl->optimizeDeliveryOrder(depot, deliveries, token);
+}
+
+future<PlanResult> AsyncPlanner::generateDeliveryPlan(
+    const GeoCoord& depot, const vector<DeliveryRequest>& deliveries, const CancellationToken& token)
+{
+    return m_impl->generateDeliveryPlan(depot, deliveries, token);
+}
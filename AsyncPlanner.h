@@ -0,0 +1,79 @@
+#ifndef ASYNCPLANNER_INCLUDED
+#define ASYNCPLANNER_INCLUDED
+
+#include "provided.h"
+#include "StreetGraph.h"
+#include "CancellationToken.h"
+#include <future>
+#include <string>
+#include <vector>
+
+// AsyncPlanner.h
+
+// Non-blocking front end for routing, ordering and planning.  Every call queues the work
+// on the planner's own worker threads and returns a future right away.  The token passed
+// in is polled inside the A* and annealing loops, so a cancelled or expired request stops
+// within a few hundred search steps.  An ordering then holds the best order found so far
+// (complete is false); a route holds CANCELLED and no edges; a plan holds the best order's
+// commands if its legs had all been routed by then, and CANCELLED with none otherwise.
+// Built on a MapHandle, each request runs against the snapshot current when a worker picks
+// it up, so a reload never interrupts a request and never has to wait for one.
+
+struct RouteResult
+{
+    RouteResult() : result(NO_ROUTE), distance(0), mapVersion(0) {}
+    DeliveryResult result;
+    std::vector<EdgeId> edges;      // StreetGraph edge ids, start to end
+    double distance;
+    unsigned long mapVersion;       // MapSnapshot the edge ids belong to
+};
+
+struct OrderResult
+{
+    OrderResult() : complete(false), oldCrowDistance(0), newCrowDistance(0) {}
+    bool complete;                  // false if the token stopped the optimizer early
+    std::vector<DeliveryRequest> deliveries;
+    double oldCrowDistance;
+    double newCrowDistance;
+};
+
+struct PlanResult
+{
+    PlanResult() : result(NO_ROUTE), distance(0) {}
+    DeliveryResult result;
+    std::vector<DeliveryCommand> commands;
+    double distance;
+};
+
+class AsyncPlannerImpl;
+class MapHandle;
+
+class AsyncPlanner
+{
+public:
+      // numThreads <= 0 means one worker per hardware thread
+    AsyncPlanner(const StreetMap* sm, int numThreads = 0);
+      // follows the handle's reloads; the handle must outlive the planner
+    AsyncPlanner(const MapHandle* handle, int numThreads = 0);
+      // finishes every request already queued before returning
+    ~AsyncPlanner();
+    std::future<RouteResult> generatePointToPointRoute(
+        const GeoCoord& start,
+        const GeoCoord& end,
+        const CancellationToken& token = CancellationToken());
+    std::future<OrderResult> optimizeDeliveryOrder(
+        const GeoCoord& depot,
+        const std::vector<DeliveryRequest>& deliveries,
+        const CancellationToken& token = CancellationToken());
+    std::future<PlanResult> generateDeliveryPlan(
+        const GeoCoord& depot,
+        const std::vector<DeliveryRequest>& deliveries,
+        const CancellationToken& token = CancellationToken());
+      // We prevent an AsyncPlanner object from being copied or assigned.
+    AsyncPlanner(const AsyncPlanner&) = delete;
+    AsyncPlanner& operator=(const AsyncPlanner&) = delete;
+private:
+    AsyncPlannerImpl* m_impl;
+};
+
+#endif // ASYNCPLANNER_INCLUDED
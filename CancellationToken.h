@@ -0,0 +1,68 @@
+#ifndef CANCELLATIONTOKEN_INCLUDED
+#define CANCELLATIONTOKEN_INCLUDED
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+
+// CancellationToken.h
+
+// Shared stop signal for long-running searches.  Copies of a token share one state, so
+// the caller keeps a copy to cancel() while the worker polls isCancelled().  A token can
+// also carry a deadline, after which it reports cancelled on its own.  The searches only
+// poll every few hundred steps, so checking the clock doesn't show up in their cost.
+
+class CancellationToken
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+      // never cancelled unless cancel() is called
+    CancellationToken()
+     : m_state(std::make_shared<State>())
+    {}
+
+    static CancellationToken withDeadline(Clock::time_point deadline)
+    {
+        CancellationToken t;
+        t.m_state->hasDeadline = true;
+        t.m_state->deadline = deadline;
+        return t;
+    }
+
+    static CancellationToken withTimeout(std::chrono::milliseconds timeout)
+    {
+        return withDeadline(Clock::now() + timeout);
+    }
+
+    void cancel() const
+    {
+        m_state->cancelled.store(true, std::memory_order_relaxed);
+    }
+
+    bool isCancelled() const
+    {
+        if (m_state->cancelled.load(std::memory_order_relaxed))
+            return true;
+        if (m_state->hasDeadline && Clock::now() >= m_state->deadline)
+        {
+            m_state->cancelled.store(true, std::memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
+
+private:
+    struct State {
+        State() : cancelled(false), hasDeadline(false) {}
+        std::atomic<bool> cancelled;
+        bool hasDeadline;
+        Clock::time_point deadline;
+    };
+    std::shared_ptr<State> m_state;
+};
+
+  // how many search steps run between isCancelled() polls
+const int CANCELLATION_CHECK_INTERVAL = 256;
+
+#endif // CANCELLATIONTOKEN_INCLUDED
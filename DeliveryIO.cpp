@@ -0,0 +1,352 @@
+#include "DeliveryIO.h"
+#include "StreetGraph.h"
+#include <fstream>
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <cstdint>
+using namespace std;
+
+// DeliveryIO.cpp
+
+static bool isBlank(char c){
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+//the whitespace-separated token at or after pos, as operator>> would read it; empty at the end
+static string_view nextToken(string_view s, size_t& pos){
+    while(pos < s.size() && isBlank(s[pos]))
+        pos++;
+    size_t start = pos;
+    while(pos < s.size() && !isBlank(s[pos]))
+        pos++;
+    return s.substr(start, pos - start);
+}
+
+//the whole token has to be a number; from_chars rounds exactly as stod does
+static bool toDegrees(string_view text, double& value){
+    const char* b = text.data();
+    const char* e = b + text.size();
+    if(b != e && *b == '+')
+        b++;
+    from_chars_result r = from_chars(b, e, value);
+    return r.ec == errc() && r.ptr == e;
+}
+
+//fills gc directly rather than through GeoCoord(string, string), which would parse again
+static bool makeCoord(string_view lat, string_view lon, GeoCoord& gc){
+    double la, lo;
+    if(!toDegrees(lat, la) || !toDegrees(lon, lo))
+        return false;
+    gc.latitudeText.assign(lat);
+    gc.longitudeText.assign(lon);
+    gc.latitude = la;
+    gc.longitude = lo;
+    return true;
+}
+
+static void skipLine(DeliveryFile& df, const char* why, string_view line){
+    df.problems += why;
+    df.problems += " in deliveries file line: ";
+    df.problems += line;
+    df.problems += '\n';
+}
+
+static void parseDeliveryLine(string_view line, int lineNumber, DeliveryFile& df){
+    size_t colon = line.find(':');
+    if(colon == string_view::npos){
+        skipLine(df, "Missing colon", line);
+        return;
+    }
+    string_view coords = line.substr(0, colon);
+    size_t pos = 0;
+    string_view lat = nextToken(coords, pos);
+    string_view lon = nextToken(coords, pos);
+    if(lon.empty()){
+        skipLine(df, "Bad format", line);
+        return;
+    }
+    string_view item = line.substr(colon + 1);
+    if(item.empty()){
+        skipLine(df, "Missing item", line);
+        return;
+    }
+    GeoCoord gc;
+    if(!makeCoord(lat, lon, gc)){
+        skipLine(df, "Bad format", line);
+        return;
+    }
+    df.deliveries.emplace_back(string(item), gc);
+    df.lineOf.push_back(lineNumber);
+}
+
+bool parseDeliveries(string_view text, DeliveryFile& df){
+    //the depot is the first two tokens; anything after them on their line is ignored
+    size_t pos = 0;
+    string_view lat = nextToken(text, pos);
+    string_view lon = nextToken(text, pos);
+    if(lon.empty() || !makeCoord(lat, lon, df.depot))
+        return false;
+    int lineNumber = 1 + (int)count(text.begin(), text.begin() + pos, '\n');
+    pos = text.find('\n', pos);
+    if(pos == string_view::npos)
+        return true;
+    pos++;
+    lineNumber++;
+
+    size_t lines = count(text.begin() + pos, text.end(), '\n') + 1;
+    df.deliveries.reserve(df.deliveries.size() + lines);
+    df.lineOf.reserve(df.lineOf.size() + lines);
+    while(pos < text.size()){
+        size_t end = text.find('\n', pos);
+        if(end == string_view::npos)
+            end = text.size();
+        parseDeliveryLine(text.substr(pos, end - pos), lineNumber, df);
+        pos = end + 1;
+        lineNumber++;
+    }
+    return true;
+}
+
+bool readDeliveriesFile(const string& file, DeliveryFile& df){
+    ifstream inf(file, ios::binary);
+    if(!inf)
+        return false;
+    inf.seekg(0, ios::end);
+    streamoff size = inf.tellg();
+    if(size < 0)
+        return false;
+    string text((size_t)size, '\0');
+    inf.seekg(0, ios::beg);
+    if(!inf.read(&text[0], size))
+        return false;
+    return parseDeliveries(text, df);
+}
+
+vector<int> findUnknownStops(const StreetGraph& g, const DeliveryFile& df){
+    vector<int> unknown;
+    NodeId n;
+    if(!g.findNode(df.depot, n))
+        unknown.push_back(-1);
+    for(int i = 0; i < (int)df.deliveries.size(); i++)
+        if(!g.findNode(df.deliveries[i].location, n))
+            unknown.push_back(i);
+    return unknown;
+}
+
+bool parsePlanFormat(const string& name, PlanFormat& format){
+    if(name == "text")
+        format = TEXT_PLAN;
+    else if(name == "json")
+        format = JSON_PLAN;
+    else if(name == "csv")
+        format = CSV_PLAN;
+    else if(name == "binary")
+        format = BINARY_PLAN;
+    else
+        return false;
+    return true;
+}
+
+//printf's %.2f is what ostream's fixed with precision 2 produces
+static void appendFixed2(string& out, double v){
+    char buf[512];
+    int n = snprintf(buf, sizeof(buf), "%.2f", v);
+    out.append(buf, min(n, (int)sizeof(buf) - 1));
+}
+
+//shortest text that reads back as the same double
+static void appendNumber(string& out, double v){
+    char buf[32];
+    to_chars_result r = to_chars(buf, buf + sizeof(buf), v);
+    out.append(buf, r.ptr);
+}
+
+static void writeText(const vector<DeliveryCommand>& commands, double totalMiles, string& out){
+    out += "Starting at the depot...\n";
+    for(const DeliveryCommand& c : commands){
+        if(c.isProceed()){
+            out += "Proceed ";
+            out += c.direction();
+            out += " on ";
+            out += c.streetName();
+            out += " for ";
+            appendFixed2(out, c.distance());
+            out += " miles\n";
+        }
+        else if(c.isTurn()){
+            out += "Turn ";
+            out += c.direction();
+            out += " on ";
+            out += c.streetName();
+            out += '\n';
+        }
+        else if(c.isDeliver()){
+            out += "DELIVER ";
+            out += c.item();
+            out += '\n';
+        }
+        else
+            out += "<invalid>\n";
+    }
+    out += "You are back at the depot and your deliveries are done!\n";
+    appendFixed2(out, totalMiles);
+    out += " miles travelled for all deliveries.\n";
+}
+
+static void appendJsonString(string& out, const string& s){
+    out += '"';
+    for(char ch : s){
+        unsigned char c = ch;
+        if(c == '"' || c == '\\'){
+            out += '\\';
+            out += ch;
+        }
+        else if(c < 0x20){
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        }
+        else
+            out += ch;
+    }
+    out += '"';
+}
+
+static void writeJson(const vector<DeliveryCommand>& commands, double totalMiles, string& out){
+    out += "{\"commands\":[";
+    for(size_t i = 0; i < commands.size(); i++){
+        const DeliveryCommand& c = commands[i];
+        if(i > 0)
+            out += ',';
+        if(c.isProceed()){
+            out += "{\"type\":\"proceed\",\"direction\":";
+            appendJsonString(out, c.direction());
+            out += ",\"street\":";
+            appendJsonString(out, c.streetName());
+            out += ",\"miles\":";
+            appendNumber(out, c.distance());
+        }
+        else if(c.isTurn()){
+            out += "{\"type\":\"turn\",\"direction\":";
+            appendJsonString(out, c.direction());
+            out += ",\"street\":";
+            appendJsonString(out, c.streetName());
+        }
+        else if(c.isDeliver()){
+            out += "{\"type\":\"deliver\",\"item\":";
+            appendJsonString(out, c.item());
+        }
+        else
+            out += "{\"type\":\"invalid\"";
+        out += '}';
+    }
+    out += "],\"totalMiles\":";
+    appendNumber(out, totalMiles);
+    out += "}\n";
+}
+
+//quoted only when it has to be, as RFC 4180 describes
+static void appendCsvField(string& out, const string& s){
+    if(s.find_first_of(",\"\r\n") == string::npos){
+        out += s;
+        return;
+    }
+    out += '"';
+    for(char c : s){
+        if(c == '"')
+            out += '"';
+        out += c;
+    }
+    out += '"';
+}
+
+static void writeCsv(const vector<DeliveryCommand>& commands, double totalMiles, string& out){
+    out += "type,direction,street,miles,item\n";
+    for(const DeliveryCommand& c : commands){
+        if(c.isProceed()){
+            out += "proceed,";
+            appendCsvField(out, c.direction());
+            out += ',';
+            appendCsvField(out, c.streetName());
+            out += ',';
+            appendNumber(out, c.distance());
+            out += ",\n";
+        }
+        else if(c.isTurn()){
+            out += "turn,";
+            appendCsvField(out, c.direction());
+            out += ',';
+            appendCsvField(out, c.streetName());
+            out += ",,\n";
+        }
+        else if(c.isDeliver()){
+            out += "deliver,,,,";
+            appendCsvField(out, c.item());
+            out += '\n';
+        }
+        else
+            out += "invalid,,,,\n";
+    }
+    out += "total,,,";
+    appendNumber(out, totalMiles);
+    out += ",\n";
+}
+
+template<typename T>
+static void appendRaw(string& out, T v){
+    char buf[sizeof(T)];
+    memcpy(buf, &v, sizeof(T));
+    out.append(buf, sizeof(T));
+}
+
+static void appendBinaryString(string& out, const string& s){
+    appendRaw<uint32_t>(out, (uint32_t)s.size());
+    out += s;
+}
+
+// Binary plans, in host byte order:
+//     "DPLN", uint32 version (1), uint32 command count,
+//     per command: uint8 type (0 invalid, 1 proceed, 2 turn, 3 deliver), float64 miles
+//                  (0 unless proceed), then direction, street and item, each as a uint32
+//                  length followed by that many bytes,
+//     float64 total miles.
+static void writeBinary(const vector<DeliveryCommand>& commands, double totalMiles, string& out){
+    out += "DPLN";
+    appendRaw<uint32_t>(out, 1);
+    appendRaw<uint32_t>(out, (uint32_t)commands.size());
+    const string none;
+    for(const DeliveryCommand& c : commands){
+        uint8_t type = c.isProceed() ? 1 : c.isTurn() ? 2 : c.isDeliver() ? 3 : 0;
+        appendRaw<uint8_t>(out, type);
+        appendRaw<double>(out, c.isProceed() ? c.distance() : 0.0);
+        appendBinaryString(out, type == 1 || type == 2 ? c.direction() : none);
+        appendBinaryString(out, type == 1 || type == 2 ? c.streetName() : none);
+        appendBinaryString(out, type == 3 ? c.item() : none);
+    }
+    appendRaw<double>(out, totalMiles);
+}
+
+void writePlan(PlanFormat format, const vector<DeliveryCommand>& commands, double totalMiles, string& out){
+    //roughly one short line per command
+    out.reserve(out.size() + 64 * commands.size() + 128);
+    switch(format){
+        case TEXT_PLAN:
+            writeText(commands, totalMiles, out);
+            break;
+        case JSON_PLAN:
+            writeJson(commands, totalMiles, out);
+            break;
+        case CSV_PLAN:
+            writeCsv(commands, totalMiles, out);
+            break;
+        case BINARY_PLAN:
+            writeBinary(commands, totalMiles, out);
+            break;
+    }
+}
+
+bool writeOut(const string& out, FILE* f){
+    size_t written = fwrite(out.data(), 1, out.size(), f);
+    return fflush(f) == 0 && written == out.size();
+}
@@ -0,0 +1,55 @@
+#ifndef DELIVERYIO_INCLUDED
+#define DELIVERYIO_INCLUDED
+
+#include "provided.h"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdio>
+
+class StreetGraph;
+
+// DeliveryIO.h
+
+// Bulk reading of deliveries files and writing of plans.  A deliveries file is read with
+// one call into one buffer and parsed in place; a plan is formatted into one string that
+// the caller writes out once, so neither side pays for a stream operation per line.
+//
+// Deliveries file format: the depot's "lat lon" on the first line, then one
+// "lat lon:item" per line.  Lines that don't parse are skipped with a message.
+
+struct DeliveryFile
+{
+    GeoCoord depot;
+    std::vector<DeliveryRequest> deliveries;
+    std::vector<int> lineOf;        // file line (1-based) of each delivery
+    std::string problems;           // one message per skipped line, newline terminated
+};
+
+  // false if the file can't be read or has no depot line
+bool readDeliveriesFile(const std::string& file, DeliveryFile& df);
+bool parseDeliveries(std::string_view text, DeliveryFile& df);
+
+  // indexes into df.deliveries of stops that aren't map nodes, with -1 standing for the
+  // depot; one hash lookup per stop, without starting any search
+std::vector<int> findUnknownStops(const StreetGraph& g, const DeliveryFile& df);
+
+enum PlanFormat
+{
+    TEXT_PLAN,      // what the planner has always printed
+    JSON_PLAN,      // {"commands":[{"type":"proceed",...},...],"totalMiles":...}
+    CSV_PLAN,       // type,direction,street,miles,item rows, then a "total" row
+    BINARY_PLAN     // see writePlan in DeliveryIO.cpp
+};
+
+  // "text", "json", "csv" or "binary"
+bool parsePlanFormat(const std::string& name, PlanFormat& format);
+
+  // appends the whole plan to out
+void writePlan(PlanFormat format, const std::vector<DeliveryCommand>& commands,
+               double totalMiles, std::string& out);
+
+  // one fwrite of the whole buffer, then a flush; false on a short write
+bool writeOut(const std::string& out, std::FILE* f);
+
+#endif // DELIVERYIO_INCLUDED
@@ -1,81 +1,165 @@
 #include "provided.h"
+#include "StreetGraph.h"
+#include "CancellationToken.h"
+#include "RoutingOptions.h"
+#include "SpeedProfile.h"
+#include "PlanningContext.h"
+#include "Metrics.h"
 #include <math.h>
 #include <list>
 #include <vector>
 #include <random>
 #include <map>
+#include <limits>
+#include <algorithm>
+#include <unordered_map>
+#include <functional>
+#include <thread>
+#include <atomic>
 
 using namespace std;
 
-struct GeoObj;
 class DeliveryOptimizerImpl {
 public:
-    DeliveryOptimizerImpl(const StreetMap* sm);
+    DeliveryOptimizerImpl(const StreetMap* sm, const RoutingOptions& options);
     ~DeliveryOptimizerImpl();
     void optimizeDeliveryOrder(
         const GeoCoord& depot,vector<DeliveryRequest>& deliveries,
         double& oldCrowDistance,double& newCrowDistance) const;
+    bool optimizeDeliveryOrder(
+        const GeoCoord& depot,vector<DeliveryRequest>& deliveries,
+        double& oldCrowDistance,double& newCrowDistance,
+        const CancellationToken* token, PlanningContext* legs = nullptr) const;
+    bool optimizeDeliveryOrder(
+        const GeoCoord& depot, vector<TimedDeliveryRequest>& deliveries,
+        const VehicleProfile& vehicle,
+        double& oldCrowDistance, double& newCrowDistance) const;
     
 private:
-    double getTotalDistance(vector<DeliveryRequest>& deliveries, const GeoCoord& depot, vector<GeoObj>& aux) const;
+    bool anneal(const GeoCoord& depot, vector<DeliveryRequest>& deliveries,
+                double& oldCrowDistance, double& newCrowDistance,
+                const CancellationToken* token, PlanningContext* legs) const;
+    bool optimizeWithWindows(const GeoCoord& depot, vector<TimedDeliveryRequest>& deliveries,
+                             const VehicleProfile& vehicle,
+                             double& oldCrowDistance, double& newCrowDistance) const;
+    double getTotalDistance(vector<DeliveryRequest>& deliveries, const GeoCoord& depot, PlanningContext& legs,
+                            const CancellationToken* token,
+                            double cutoff = numeric_limits<double>::infinity()) const;
+    DeliveryResult findLeg(const GeoCoord& from, const GeoCoord& to, RouteArena& arena, EdgePath& route,
+                           double& miles, double& cost, const CancellationToken* token) const;
     double getTotalEuclidian(vector<DeliveryRequest>& deliveries, const GeoCoord& depot) const;
     vector<DeliveryRequest> getRandomChange(vector<DeliveryRequest>& deliveries) const;
+    vector<int> getNeighborChange(const vector<int>& order, const vector<vector<int> >& nearest) const;
+    bool buildDistanceMatrix(const vector<GeoCoord>& points, vector<vector<double> >& dist) const;
+    bool optimizeLargeDeliveryOrder(const GeoCoord& depot, vector<DeliveryRequest>& deliveries,
+                                    double& newCrowDistance, const CancellationToken* token,
+                                    PlanningContext& routed) const;
+    const StreetMap* m_map;
     PointToPointRouter ptpr;
+    const EdgeWeights* m_weights;   // null when legs are measured in miles
+    bool m_turnCosts;               // legs are routed edge by edge with turn penalties, so
+                                    // each one is only good for the way it was routed
 };
 
-struct GeoObj {
-    GeoObj(GeoCoord x, GeoCoord y, double d) : a(x), b(y), dis(d) {}
-    GeoCoord a;
-    GeoCoord b;
-    double dis;
-};
-
-//checks if the distance has already been calculated between two points,
-//meaning the shortest route has already been found between them, and the calculation
-//need not be performed again
-bool checkIfDistanceExists(GeoCoord first, GeoCoord second, double& distance, vector<GeoObj>& aux){
-    for(int i = 0; i < aux.size(); i++){
-        if((aux[i].a == first && aux[i].b == second) || (aux[i].b == first && aux[i].a == second)){
-            distance = aux[i].dis;
-            return true;
-        }
-    }
-    return false;
+DeliveryOptimizerImpl::DeliveryOptimizerImpl(const StreetMap* sm, const RoutingOptions& options)
+ : m_map(sm), ptpr(sm, options), m_weights(options.weights), m_turnCosts(options.useTurnCosts){
 }
 
-DeliveryOptimizerImpl::DeliveryOptimizerImpl(const StreetMap* sm) : ptpr(sm){
+DeliveryOptimizerImpl::~DeliveryOptimizerImpl(){
 }
 
-DeliveryOptimizerImpl::~DeliveryOptimizerImpl(){
+
+DeliveryResult DeliveryOptimizerImpl::findLeg(const GeoCoord& from, const GeoCoord& to, RouteArena& arena, EdgePath& route,
+                                              double& miles, double& cost, const CancellationToken* token) const{
+    DeliveryResult res;
+    if(token == nullptr)
+        res = ptpr.generatePointToPointRoute(from, to, arena, route, miles);
+    else
+        res = ptpr.generatePointToPointRoute(from, to, arena, route, miles, *token);
+    //the router reports miles; with a weight layer the leg's cost is what gets compared
+    cost = miles;
+    if(res == DELIVERY_SUCCESS && m_weights != nullptr){
+        cost = 0;
+        for(EdgeId e : route)
+            cost += m_weights->weight(e);
+    }
+    return res;
 }
 
+static const Histogram runSeconds("optimizer_run_seconds", "Time to optimize one delivery order",
+                                  Histogram::latencyBuckets());
+static const Histogram improvement("optimizer_improvement_ratio",
+                                   "Optimized tour length over the original order's crow-flies length, for tours in miles",
+                                   Histogram::ratioBuckets());
+static const Counter legHits("optimizer_leg_cache_hits_total", "Tour legs priced from legs already routed");
+static const Counter legMisses("optimizer_leg_cache_misses_total", "Tour legs that had to be routed");
+static const Counter toursPruned("optimizer_tours_pruned_total",
+                                 "Candidate tours rejected on their crow-distance bound before being fully routed");
+
+//Any leg is only routed once, in either direction, and then kept in legs along with its
+//edge ids. Returns a negative total if token was cancelled before every leg was known.
+//
+//Before a leg is routed, the legs already known count at their cost and the rest at their
+//crow distance, which no route can beat. If that lower bound already reaches cutoff the
+//tour is given up on and infinity returned, so the rest of its legs are never routed.
+//The bound is shaded down a hair so rounding can never turn it into a false rejection.
+static const double BOUND_SLACK = 1 - 1e-9;
 
-//Any distance between two locations is only calculated once and then stored in a vector
-double DeliveryOptimizerImpl::getTotalDistance(vector<DeliveryRequest>& deliveries, const GeoCoord& depot, vector<GeoObj>& aux) const{
+double DeliveryOptimizerImpl::getTotalDistance(vector<DeliveryRequest>& deliveries, const GeoCoord& depot, PlanningContext& legs,
+                                               const CancellationToken* token, double cutoff) const{
     if(deliveries.size() == 0) return 0;
-    list<StreetSegment> route;
-    double total = 0, distance = 0;
-    
-    for(int i = 0; i < deliveries.size(); i++){
-        if(i == 0){
-            if(!checkIfDistanceExists(depot, deliveries[i].location, distance, aux)){
-                ptpr.generatePointToPointRoute(depot, deliveries[i].location, route, distance);
-                aux.push_back(GeoObj(depot, deliveries[i].location, distance));
-            }
-        } else {
-            if(!checkIfDistanceExists(deliveries[i-1].location, deliveries[i].location, distance, aux)){
-                ptpr.generatePointToPointRoute(deliveries[i-1].location, deliveries[i].location, route, distance);
-                aux.push_back(GeoObj(deliveries[i-1].location, deliveries[i].location, distance));
+    const StreetGraph& g = m_map->graph();
+    RouteArena arena;
+    double total = 0, distance = 0, miles = 0;
+
+    //leg i runs from stop i-1 to stop i, with the depot at both ends; remaining[i] bounds
+    //legs i onwards. A stop that isn't on the map can't be routed, so nothing is bounded.
+    size_t count = deliveries.size() + 1;
+    vector<NodeId> ends(count + 1);
+    bool onMap = g.findNode(depot, ends[0]);
+    for(size_t i = 1; i < count && onMap; i++)
+        onMap = g.findNode(deliveries[i-1].location, ends[i]);
+    ends[count] = ends[0];
+    vector<double> cost(count, 0), remaining(count + 1, 0);
+    vector<bool> cached(count, false);
+    //crow miles are a lower bound on a leg's miles, and on its minutes at top speed
+    double perMile = m_weights == nullptr ? 1 : m_weights->minPerMile();
+    for(size_t i = count; onMap && i-- > 0; ){
+        cached[i] = legs.findCost(ends[i], ends[i+1], cost[i]);
+        if(!cached[i] && g.connected(ends[i], ends[i+1]))
+            cost[i] = g.crowDistance(ends[i], ends[i+1]) * perMile;
+        remaining[i] = remaining[i+1] + cost[i];
+    }
+    bool bounded = onMap && cutoff < numeric_limits<double>::infinity();
+
+    size_t routedLegs = 0;
+    for(size_t i = 0; i < count; i++){
+        const GeoCoord& from = i == 0 ? depot : deliveries[i-1].location;
+        const GeoCoord& to = i == count - 1 ? depot : deliveries[i].location;
+        NodeId a = ends[i], b = ends[i+1];
+        bool known = onMap || (g.findNode(from, a) && g.findNode(to, b));
+        if(onMap && cached[i])
+            distance = cost[i];
+        else if(!known || !legs.findCost(a, b, distance)){
+            if(bounded && (total + remaining[i]) * BOUND_SLACK >= cutoff){
+                legHits.add(i - routedLegs);
+                legMisses.add(routedLegs);
+                toursPruned.add();
+                return numeric_limits<double>::infinity();
             }
+            routedLegs++;
+            EdgePath route;
+            arena.reset();
+            DeliveryResult res = findLeg(from, to, arena, route, miles, distance, token);
+            if(res == CANCELLED)
+                return -1;
+            if(known && res == DELIVERY_SUCCESS)
+                legs.addLeg(a, b, route, miles, distance, m_turnCosts);
         }
         total += distance;
     }
-    if(!checkIfDistanceExists(deliveries[deliveries.size()-1].location, depot, distance, aux)){
-        ptpr.generatePointToPointRoute(deliveries[deliveries.size()-1].location, depot, route, distance);
-        aux.push_back(GeoObj(deliveries[deliveries.size()-1].location, depot, distance));
-    }
-    total += distance;
-   
+    legHits.add(count - routedLegs);
+    legMisses.add(routedLegs);
     return total;
 }
 
@@ -107,39 +191,778 @@ vector<DeliveryRequest> DeliveryOptimizerImpl::getRandomChange(vector<DeliveryRe
     return newDeliveryOrder;
 }
 
+//candidate lists for the annealer: every stop's NEIGHBOR_COUNT nearest other stops by
+//crow distance, nearest first. O(n^2 log k), and no routing is needed.
+static const int NEIGHBOR_COUNT = 8;
+
+static void nearestNeighbors(const vector<DeliveryRequest>& deliveries, vector<vector<int> >& nearest){
+    int n = (int)deliveries.size();
+    int k = min(NEIGHBOR_COUNT, n - 1);
+    nearest.assign(n, vector<int>());
+    vector<pair<double, int> > byDistance;
+    for(int i = 0; i < n; i++){
+        byDistance.clear();
+        for(int j = 0; j < n; j++){
+            if(j != i)
+                byDistance.push_back(make_pair(distanceEarthMiles(deliveries[i].location, deliveries[j].location), j));
+        }
+        partial_sort(byDistance.begin(), byDistance.begin() + k, byDistance.end());
+        for(int j = 0; j < k; j++)
+            nearest[i].push_back(byDistance[j].second);
+    }
+}
+
+//picks a stop and one of its near neighbours and makes them adjacent, so the move can
+//only shorten the tour if the two belong together. order holds indices into the
+//original deliveries. The move is one of:
+//  2-opt: reverse the stretch between them, which swaps two edges of the tour
+//  or-opt: move a run of one to three stops starting at the first to just after the second
+//  swap: exchange the two stops
+vector<int> DeliveryOptimizerImpl::getNeighborChange(const vector<int>& order, const vector<vector<int> >& nearest) const{
+    int n = (int)order.size();
+    vector<int> position(n);
+    for(int p = 0; p < n; p++)
+        position[order[p]] = p;
+    int a = (int) rand()%n;
+    int b = nearest[a][rand()%nearest[a].size()];
+    int i = position[a], j = position[b];
+
+    vector<int> changed(order);
+    switch(rand()%3){
+    case 0:
+        if(i < j)
+            reverse(changed.begin() + i + 1, changed.begin() + j + 1);
+        else
+            reverse(changed.begin() + j, changed.begin() + i);
+        break;
+    case 1: {
+        int runLength = 1 + rand()%3;
+        if(i + runLength > n)
+            runLength = n - i;
+        //b inside the run has nowhere to put it
+        if(j >= i && j < i + runLength)
+            break;
+        vector<int> run(changed.begin() + i, changed.begin() + i + runLength);
+        changed.erase(changed.begin() + i, changed.begin() + i + runLength);
+        int after = j > i ? j - runLength : j;
+        changed.insert(changed.begin() + after + 1, run.begin(), run.end());
+        break;
+    }
+    default:
+        swap(changed[i], changed[j]);
+        break;
+    }
+    return changed;
+}
+
 
 
 void DeliveryOptimizerImpl::optimizeDeliveryOrder(
     const GeoCoord& depot, vector<DeliveryRequest>& deliveries,
     double& oldCrowDistance, double& newCrowDistance) const
+{
+    optimizeDeliveryOrder(depot, deliveries, oldCrowDistance, newCrowDistance, nullptr, nullptr);
+}
+
+//above this many stops the clustered large-instance mode takes over (see below)
+static const int LARGE_INSTANCE_STOPS = 400;
+
+//simulated annealing over swaps of two stops. The best order seen is what's returned, so
+//stopping early on a cancelled token still hands back the best result so far. Once there
+//are more stops than fit in one neighbour list, moves are drawn from the neighbour lists
+//instead: a uniform swap on a long route nearly always pairs stops on opposite sides of
+//the map and is rejected, wasting the iteration. Every leg routed along the way goes into
+//legs when one is given, so the caller can build the final route without routing again.
+bool DeliveryOptimizerImpl::anneal(
+    const GeoCoord& depot, vector<DeliveryRequest>& deliveries,
+    double& oldCrowDistance, double& newCrowDistance,
+    const CancellationToken* token, PlanningContext* legs) const
 {
     oldCrowDistance = getTotalEuclidian(deliveries, depot);
-    vector<GeoObj> aux;
+    PlanningContext ownLegs(m_map->graph());
+    PlanningContext& routed = legs != nullptr ? *legs : ownLegs;
+    if((int)deliveries.size() > LARGE_INSTANCE_STOPS)
+        return optimizeLargeDeliveryOrder(depot, deliveries, newCrowDistance, token, routed);
     
     double temp = 1000;
     double distanceChange = 0;
     double coolingRate = 0.99;
     double minTemp = 0.01;
-    double distance = getTotalDistance(deliveries, depot, aux);
+    double distance = getTotalDistance(deliveries, depot, routed, token);
+    newCrowDistance = distance;
+    if(distance < 0)
+        return false;
+    vector<DeliveryRequest> best = deliveries;
+
+    const vector<DeliveryRequest> stops = deliveries;
+    bool useNeighbors = (int)stops.size() > NEIGHBOR_COUNT + 1;
+    vector<vector<int> > nearest;
+    vector<int> order, possibleOrder;
+    if(useNeighbors){
+        nearestNeighbors(stops, nearest);
+        for(int i = 0; i < (int)stops.size(); i++)
+            order.push_back(i);
+    }
 
-    while (temp > minTemp){
+    //a single stop has nothing to swap with
+    while (temp > minTemp && deliveries.size() > 1){
         //BELOW FOR TESTING ONLY
         //cerr << "Distance: " << distance << "  Temperature: " << temp << endl;
+        if(token != nullptr && token->isCancelled())
+            break;
         
-        vector<DeliveryRequest> possibleDeliveryRoute = getRandomChange(deliveries);
-        distanceChange = getTotalDistance(possibleDeliveryRoute, depot, aux) - distance;
+        vector<DeliveryRequest> possibleDeliveryRoute;
+        if(useNeighbors){
+            possibleOrder = getNeighborChange(order, nearest);
+            for(size_t p = 0; p < possibleOrder.size(); p++)
+                possibleDeliveryRoute.push_back(stops[possibleOrder[p]]);
+        } else
+            possibleDeliveryRoute = getRandomChange(deliveries);
 
+        //the draw is known before the candidate is priced, and with it the longest tour the
+        //step would accept; getTotalDistance stops routing a tour bound to come out longer
         uniform_real_distribution<double> unif(0,1);
         default_random_engine re;
-        
-        if ((distanceChange < 0) || (distance > 0 && exp(-distanceChange / temp) > unif(re) )){
+        double draw = unif(re);
+        double cutoff = distance;
+        if(distance > 0)
+            cutoff = draw > 0 ? distance - temp * log(draw) : numeric_limits<double>::infinity();
+
+        double possibleDistance = getTotalDistance(possibleDeliveryRoute, depot, routed, token, cutoff);
+        if(possibleDistance < 0)
+            break;
+        distanceChange = possibleDistance - distance;
+
+        if ((distanceChange < 0) || (distance > 0 && exp(-distanceChange / temp) > draw )){
             deliveries = possibleDeliveryRoute;
+            order.swap(possibleOrder);
             distance = distanceChange + distance;
+            if(distance < newCrowDistance){
+                best = deliveries;
+                newCrowDistance = distance;
+            }
         }
 
         temp *= coolingRate;
     }
-    newCrowDistance = distance;
+    deliveries = best;
+    return token == nullptr || !token->isCancelled();
+}
+
+//******************** large instance mode ************************************
+
+//Past a few hundred stops neither annealing over the whole permutation nor an N x N matrix
+//is practical (10,000 stops would be 800 MB of doubles). Instead stops are split into small
+//geographic clusters by recursive median bisection, each cluster gets its own tour from a
+//matrix of its own stops only, the clusters are put in order by their centres, and the
+//cluster tours are cut open and chained. A last pass of local search runs over a window of
+//stops on each side of every cluster boundary, where the stitching is weakest. Clusters and
+//windows are independent, so both are spread over one worker per core. The searches behind
+//the matrices keep their routes, so every leg the finished tour uses goes into the caller's
+//PlanningContext and the plan is built without searching again. No order is measured until
+//the very end, so a cancelled run leaves deliveries as they were.
+static const int CLUSTER_SIZE = 48;
+static const int BOUNDARY_WINDOW = 8;
+static const double UNREACHABLE = 1e9;
+
+//Leg lengths for a tour over many stops without the full matrix: one dense block per
+//cluster, plus a hash map for the few legs between clusters that some window has measured.
+//Stop n is the depot. Memory is O(N * CLUSTER_SIZE).
+class SparseDistances {
+public:
+    SparseDistances(int numStops)
+     : m_cluster(numStops + 1, -1), m_slot(numStops + 1, -1) {}
+    void setCluster(int c, const vector<int>& stops, vector<double>& block){
+        if((int)m_blocks.size() <= c)
+            m_blocks.resize(c + 1);
+        for(size_t i = 0; i < stops.size(); i++){
+            m_cluster[stops[i]] = c;
+            m_slot[stops[i]] = (int)i;
+        }
+        m_size.resize(m_blocks.size());
+        m_size[c] = (int)stops.size();
+        m_blocks[c].swap(block);
+    }
+    void setCross(int a, int b, double d){
+        m_cross[key(a, b)] = d;
+    }
+      // negative if the leg was never measured
+    double get(int a, int b) const{
+        if(m_cluster[a] >= 0 && m_cluster[a] == m_cluster[b])
+            return m_blocks[m_cluster[a]][m_slot[a] * m_size[m_cluster[a]] + m_slot[b]];
+        unordered_map<unsigned long long, double>::const_iterator it = m_cross.find(key(a, b));
+        return it == m_cross.end() ? -1 : it->second;
+    }
+private:
+    static unsigned long long key(int a, int b){ return ((unsigned long long)a << 32) | (unsigned int)b; }
+    vector<int> m_cluster;
+    vector<int> m_slot;
+    vector<int> m_size;
+    vector<vector<double> > m_blocks;
+    unordered_map<unsigned long long, double> m_cross;
+};
+
+//runs work(0..count-1) on one worker per core; stops handing out items once token is cancelled
+static void parallelFor(int count, const function<void(int)>& work, const CancellationToken* token){
+    atomic<int> next(0);
+    auto worker = [&](){
+        for(int i = next++; i < count; i = next++){
+            if(token != nullptr && token->isCancelled())
+                return;
+            work(i);
+        }
+    };
+    int numThreads = min(count, max(1, (int)thread::hardware_concurrency()));
+    vector<thread> workers;
+    for(int t = 1; t < numThreads; t++)
+        workers.push_back(thread(worker));
+    worker();
+    for(size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
+}
+
+//2-opt and or-opt over path[1..len-2] with both ends held in place, on an m x m matrix d.
+//A cycle is a path that starts and ends at the same point.
+static void improvePath(vector<int>& path, const vector<double>& d, int m){
+    auto D = [&](int a, int b){ return d[a * m + b]; };
+    int len = (int)path.size();
+    bool improved = true;
+    while(improved){
+        improved = false;
+        for(int i = 1; i < len - 2; i++){
+            for(int j = i + 1; j < len - 1; j++){
+                double change = D(path[i - 1], path[j]) + D(path[i], path[j + 1])
+                              - D(path[i - 1], path[i]) - D(path[j], path[j + 1]);
+                if(change < -1e-9){
+                    reverse(path.begin() + i, path.begin() + j + 1);
+                    improved = true;
+                }
+            }
+        }
+        for(int k = 1; k <= 3 && !improved; k++){
+            for(int i = 1; i + k < len && !improved; i++){
+                int first = path[i], last = path[i + k - 1], before = path[i - 1], after = path[i + k];
+                double gain = D(before, first) + D(last, after) - D(before, after);
+                for(int p = 0; p < len - 1; p++){
+                    if(p >= i - 1 && p <= i + k - 1)
+                        continue;
+                    double added = D(path[p], first) + D(last, path[p + 1]) - D(path[p], path[p + 1]);
+                    if(added - gain < -1e-9){
+                        vector<int> run(path.begin() + i, path.begin() + i + k);
+                        path.erase(path.begin() + i, path.begin() + i + k);
+                        int at = p < i ? p + 1 : p + 1 - k;
+                        path.insert(path.begin() + at, run.begin(), run.end());
+                        improved = true;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+}
+
+//network distances between every pair of points, UNREACHABLE where there is no route
+//and, given paths, the route behind each of them
+static bool localMatrix(const PointToPointRouter& router, const vector<GeoCoord>& points, vector<double>& d,
+                        RouteArena* arena = nullptr, vector<vector<EdgePath> >* paths = nullptr){
+    int m = (int)points.size();
+    d.assign(m * m, 0);
+    vector<vector<double> > rows;
+    DeliveryResult res = paths == nullptr ? router.generateDistanceMatrix(points, points, rows)
+                                          : router.generateDistanceMatrix(points, points, rows, *arena, *paths);
+    if(res != DELIVERY_SUCCESS)
+        return false;
+    for(int i = 0; i < m; i++)
+        for(int j = 0; j < m; j++)
+            d[i * m + j] = rows[i][j] < 0 ? UNREACHABLE : rows[i][j];
+    return true;
+}
+
+//A leg a cluster or window search found the route for. Workers keep their own and the
+//calling thread adds them all to the PlanningContext, which is one thread's.
+struct SettledLeg {
+    int from, to;               // stop ids
+    vector<EdgeId> edges;
+    double miles;
+    double cost;
+};
+
+static void settleLeg(const StreetGraph& g, int from, int to, const EdgePath& path, double cost,
+                      vector<SettledLeg>& settled){
+    if(cost >= UNREACHABLE)
+        return;
+    SettledLeg leg;
+    leg.from = from;
+    leg.to = to;
+    leg.edges.assign(path.begin(), path.end());
+    leg.miles = 0;
+    for(EdgeId e : path)
+        leg.miles += g.edgeLength(e);
+    leg.cost = cost;
+    settled.push_back(leg);
+}
+
+//splits ids[begin, end) at the median of its wider side until every piece is small enough
+static void bisect(const vector<DeliveryRequest>& deliveries, vector<int>& ids, int begin, int end,
+                   vector<vector<int> >& clusters){
+    if(end - begin <= CLUSTER_SIZE){
+        clusters.push_back(vector<int>(ids.begin() + begin, ids.begin() + end));
+        return;
+    }
+    double minLat = 90, maxLat = -90, minLon = 180, maxLon = -180;
+    for(int i = begin; i < end; i++){
+        const GeoCoord& g = deliveries[ids[i]].location;
+        minLat = min(minLat, g.latitude);
+        maxLat = max(maxLat, g.latitude);
+        minLon = min(minLon, g.longitude);
+        maxLon = max(maxLon, g.longitude);
+    }
+    //a degree of longitude shrinks with latitude
+    bool byLat = (maxLat - minLat) >= (maxLon - minLon) * cos(deg2rad((minLat + maxLat) / 2));
+    int mid = begin + (end - begin) / 2;
+    nth_element(ids.begin() + begin, ids.begin() + mid, ids.begin() + end, [&](int a, int b){
+        const GeoCoord& ga = deliveries[a].location;
+        const GeoCoord& gb = deliveries[b].location;
+        return byLat ? ga.latitude < gb.latitude : ga.longitude < gb.longitude;
+    });
+    bisect(deliveries, ids, begin, mid, clusters);
+    bisect(deliveries, ids, mid, end, clusters);
+}
+
+bool DeliveryOptimizerImpl::optimizeLargeDeliveryOrder(
+    const GeoCoord& depot, vector<DeliveryRequest>& deliveries,
+    double& newCrowDistance, const CancellationToken* token, PlanningContext& routed) const
+{
+    int n = (int)deliveries.size();
+    newCrowDistance = -1;
+    const StreetGraph& g = m_map->graph();
+    //the searches behind the matrices keep their routes, so every leg a tour uses is
+    //routed once; edge-based turn costs need searches of their own, so not with those
+    bool keepPaths = !m_turnCosts;
+    vector<int> ids(n);
+    for(int i = 0; i < n; i++)
+        ids[i] = i;
+    vector<vector<int> > clusters;
+    bisect(deliveries, ids, 0, n, clusters);
+    int k = (int)clusters.size();
+
+    //a tour inside each cluster, kept as a cycle of stop ids
+    SparseDistances legs(n);
+    vector<vector<double> > blocks(k);
+    vector<vector<int> > cycles(k);
+    vector<vector<SettledLeg> > settled(k);
+    atomic<bool> failed(false);
+    parallelFor(k, [&](int c){
+        const vector<int>& stops = clusters[c];
+        int m = (int)stops.size();
+        vector<GeoCoord> points;
+        for(int i = 0; i < m; i++)
+            points.push_back(deliveries[stops[i]].location);
+        RouteArena arena;
+        vector<vector<EdgePath> > paths;
+        if(!localMatrix(ptpr, points, blocks[c], &arena, keepPaths ? &paths : nullptr)){
+            failed = true;
+            return;
+        }
+        //nearest neighbour, then closed at stop 0 and improved
+        vector<bool> used(m, false);
+        vector<int> path(1, 0);
+        used[0] = true;
+        for(int step = 1; step < m; step++){
+            int from = path.back(), best = -1;
+            for(int j = 0; j < m; j++)
+                if(!used[j] && (best < 0 || blocks[c][from * m + j] < blocks[c][from * m + best]))
+                    best = j;
+            used[best] = true;
+            path.push_back(best);
+        }
+        path.push_back(0);
+        improvePath(path, blocks[c], m);
+        path.pop_back();
+        for(int i = 0; i < m; i++)
+            cycles[c].push_back(stops[path[i]]);
+        //the cycle is cut open later and may be driven either way round
+        for(int i = 0; keepPaths && i < m; i++){
+            int a = path[i], b = path[(i + 1) % m];
+            settleLeg(g, stops[a], stops[b], paths[a][b], blocks[c][a * m + b], settled[c]);
+            settleLeg(g, stops[b], stops[a], paths[b][a], blocks[c][b * m + a], settled[c]);
+        }
+    }, token);
+    if(failed || (token != nullptr && token->isCancelled()))
+        return false;
+    for(int c = 0; c < k; c++)
+        legs.setCluster(c, clusters[c], blocks[c]);
+
+    //cluster order: a tour over the cluster centres from the depot, by crow distance
+    vector<double> centerLat(k, 0), centerLon(k, 0);
+    for(int c = 0; c < k; c++){
+        for(size_t i = 0; i < clusters[c].size(); i++){
+            centerLat[c] += deliveries[clusters[c][i]].location.latitude;
+            centerLon[c] += deliveries[clusters[c][i]].location.longitude;
+        }
+        centerLat[c] /= clusters[c].size();
+        centerLon[c] /= clusters[c].size();
+    }
+    //index 0 is the depot, cluster c is c+1
+    int km = k + 1;
+    vector<double> centerDist(km * km);
+    for(int a = 0; a < km; a++){
+        for(int b = 0; b < km; b++){
+            double latA = a == 0 ? depot.latitude : centerLat[a - 1], lonA = a == 0 ? depot.longitude : centerLon[a - 1];
+            double latB = b == 0 ? depot.latitude : centerLat[b - 1], lonB = b == 0 ? depot.longitude : centerLon[b - 1];
+            centerDist[a * km + b] = crowDistanceMiles(latA, lonA, latB, lonB);
+        }
+    }
+    vector<bool> placed(km, false);
+    vector<int> clusterTour(1, 0);
+    placed[0] = true;
+    for(int step = 1; step < km; step++){
+        int from = clusterTour.back(), best = -1;
+        for(int j = 1; j < km; j++)
+            if(!placed[j] && (best < 0 || centerDist[from * km + j] < centerDist[from * km + best]))
+                best = j;
+        placed[best] = true;
+        clusterTour.push_back(best);
+    }
+    clusterTour.push_back(0);
+    improvePath(clusterTour, centerDist, km);
+
+    //cut each cluster's cycle where entering from the previous stop and leaving towards the
+    //next cluster's centre costs least, in either direction
+    vector<int> order;
+    vector<int> clusterStart;
+    double prevLat = depot.latitude, prevLon = depot.longitude;
+    for(int t = 1; t + 1 < (int)clusterTour.size(); t++){
+        int c = clusterTour[t] - 1;
+        int next = clusterTour[t + 1];
+        double nextLat = next == 0 ? depot.latitude : centerLat[next - 1];
+        double nextLon = next == 0 ? depot.longitude : centerLon[next - 1];
+        const vector<int>& cyc = cycles[c];
+        int m = (int)cyc.size();
+        double bestCost = 0;
+        int bestEntry = 0, bestDir = 1;
+        for(int e = 0; e < m; e++){
+            for(int dir = -1; dir <= 1; dir += 2){
+                int exitStop = cyc[(e - dir + m) % m];
+                const GeoCoord& in = deliveries[cyc[e]].location;
+                const GeoCoord& out = deliveries[exitStop].location;
+                double cost = crowDistanceMiles(prevLat, prevLon, in.latitude, in.longitude)
+                            + crowDistanceMiles(out.latitude, out.longitude, nextLat, nextLon)
+                            - legs.get(exitStop, cyc[e]);
+                if((e == 0 && dir == -1) || cost < bestCost){
+                    bestCost = cost;
+                    bestEntry = e;
+                    bestDir = dir;
+                }
+            }
+        }
+        clusterStart.push_back((int)order.size());
+        for(int i = 0; i < m; i++)
+            order.push_back(cyc[((bestEntry + bestDir * i) % m + m) % m]);
+        const GeoCoord& last = deliveries[order.back()].location;
+        prevLat = last.latitude;
+        prevLon = last.longitude;
+    }
+    clusterStart.push_back(n);
+
+    //local search across each boundary. Windows never overlap and their fixed ends are
+    //outside every other window, so they can all run at once on the shared order.
+    int boundaries = k - 1;
+    vector<vector<pair<unsigned long long, double> > > measured(boundaries);
+    vector<vector<SettledLeg> > windowLegs(max(boundaries, 0));
+    parallelFor(boundaries, [&](int b){
+        int left = clusterStart[b + 1] - clusterStart[b], right = clusterStart[b + 2] - clusterStart[b + 1];
+        int half = min(BOUNDARY_WINDOW, (min(left, right) - 1) / 2);
+        if(half < 1)
+            return;
+        int from = clusterStart[b + 1] - half - 1, to = clusterStart[b + 1] + half;
+        vector<GeoCoord> points;
+        for(int p = from; p <= to; p++)
+            points.push_back(deliveries[order[p]].location);
+        int m = (int)points.size();
+        vector<double> d;
+        RouteArena arena;
+        vector<vector<EdgePath> > paths;
+        if(!localMatrix(ptpr, points, d, &arena, keepPaths ? &paths : nullptr)){
+            failed = true;
+            return;
+        }
+        vector<int> path(m);
+        for(int i = 0; i < m; i++)
+            path[i] = i;
+        improvePath(path, d, m);
+        vector<int> stops(order.begin() + from, order.begin() + to + 1);
+        for(int i = 0; i < m; i++){
+            order[from + i] = stops[path[i]];
+            for(int j = 0; j < m; j++)
+                measured[b].push_back(make_pair(((unsigned long long)stops[i] << 32) | (unsigned int)stops[j], d[i * m + j]));
+        }
+        for(int i = 0; keepPaths && i + 1 < m; i++)
+            settleLeg(g, stops[path[i]], stops[path[i + 1]], paths[path[i]][path[i + 1]], d[path[i] * m + path[i + 1]],
+                      windowLegs[b]);
+    }, token);
+    if(failed || (token != nullptr && token->isCancelled()))
+        return false;
+    for(int b = 0; b < boundaries; b++)
+        for(size_t i = 0; i < measured[b].size(); i++)
+            legs.setCross((int)(measured[b][i].first >> 32), (int)(measured[b][i].first & 0xffffffff), measured[b][i].second);
+
+    //every leg the searches settled goes into routed, then the tour's total is added up
+    //from it; the legs to and from the depot and any the windows didn't cover are routed now
+    vector<NodeId> nodeOf(n + 1);
+    for(int i = 0; i < n; i++)
+        g.findNode(deliveries[i].location, nodeOf[i]);
+    if(!g.findNode(depot, nodeOf[n]))
+        return false;
+    for(vector<vector<SettledLeg> >* found : { &settled, &windowLegs })
+        for(const vector<SettledLeg>& some : *found)
+            for(const SettledLeg& leg : some)
+                routed.addLeg(nodeOf[leg.from], nodeOf[leg.to], EdgePath(leg.edges.data(), leg.edges.size()),
+                              leg.miles, leg.cost, m_turnCosts);
+    double total = 0;
+    RouteArena arena;
+    for(int i = 0; i <= n; i++){
+        int a = i == 0 ? n : order[i - 1], b = i == n ? n : order[i];
+        double cost;
+        if(!routed.findCost(nodeOf[a], nodeOf[b], cost)){
+            const GeoCoord& from = a == n ? depot : deliveries[a].location;
+            const GeoCoord& to = b == n ? depot : deliveries[b].location;
+            EdgePath path;
+            double miles;
+            arena.reset();
+            DeliveryResult res = findLeg(from, to, arena, path, miles, cost, nullptr);
+            if(res == NO_ROUTE)
+                cost = UNREACHABLE;
+            else if(res != DELIVERY_SUCCESS)
+                return false;
+            else
+                routed.addLeg(nodeOf[a], nodeOf[b], path, miles, cost, m_turnCosts);
+        }
+        total += cost;
+    }
+
+    vector<DeliveryRequest> ordered;
+    ordered.reserve(n);
+    for(int i = 0; i < n; i++)
+        ordered.push_back(deliveries[order[i]]);
+    deliveries.swap(ordered);
+    newCrowDistance = total;
+    return true;
+}
+
+//******************** time window mode ***************************************
+
+//Summary of a run of consecutive stops, following the segment concatenation scheme of
+//Vidal et al. for time windows: D is the run's duration (driving, waiting and service),
+//E/L the earliest and latest times service can start at its first stop without adding
+//lateness (L - E is the run's forward time slack), and TW the total time warp, i.e.
+//how many minutes late the run is no matter when it starts. Joining two summaries is O(1),
+//so any move that cuts the tour into a few runs is checked in constant time.
+struct TimeWindowSegment {
+    int first, last;    // matrix indices of the run's first and last stop
+    double D, E, L, TW;
+    double dist;        // miles driven inside the run
+    double load;
+};
+
+static TimeWindowSegment singleStop(int idx, double open, double close, double service, double demand){
+    TimeWindowSegment s;
+    s.first = s.last = idx;
+    s.D = service;
+    s.E = open;
+    s.L = close;
+    s.TW = 0;
+    s.dist = 0;
+    s.load = demand;
+    return s;
+}
+
+static TimeWindowSegment concat(const TimeWindowSegment& a, const TimeWindowSegment& b,
+                                const vector<vector<double> >& dist, double minutesPerMile){
+    double miles = dist[a.last][b.first];
+    double t = miles * minutesPerMile;
+    double delta = a.D - a.TW + t;
+    double waitTime = max(b.E - delta - a.L, 0.0);
+    double timeWarp = max(a.E + delta - b.L, 0.0);
+    TimeWindowSegment s;
+    s.first = a.first;
+    s.last = b.last;
+    s.D = a.D + b.D + t + waitTime;
+    s.TW = a.TW + b.TW + timeWarp;
+    s.E = max(b.E - delta, a.E) - waitTime;
+    s.L = min(b.L - delta, a.L) + timeWarp;
+    s.dist = a.dist + b.dist + miles;
+    s.load = a.load + b.load;
+    return s;
+}
+
+//minutes of lateness are priced far above any realistic detour, so the search only trades
+//distance for lateness when it has no other choice
+static const double LATENESS_PENALTY = 1000;
+
+static double tourCost(const TimeWindowSegment& s){
+    return s.dist + LATENESS_PENALTY * s.TW;
+}
+
+//fills dist[i][j] with the network distance between points i and j. A pair with no route
+//gets UNREACHABLE, large but finite: infinity would turn the segment arithmetic into
+//inf - inf = NaN, where this just makes any order using the leg hopelessly late.
+//Returns false if any point isn't on the map.
+bool DeliveryOptimizerImpl::buildDistanceMatrix(const vector<GeoCoord>& points, vector<vector<double> >& dist) const{
+    if(ptpr.generateDistanceMatrix(points, points, dist) != DELIVERY_SUCCESS)
+        return false;
+    for(size_t i = 0; i < points.size(); i++)
+        for(size_t j = 0; j < points.size(); j++)
+            if(dist[i][j] < 0)
+                dist[i][j] = UNREACHABLE;
+    return true;
+}
+
+bool DeliveryOptimizerImpl::optimizeWithWindows(
+    const GeoCoord& depot, vector<TimedDeliveryRequest>& deliveries,
+    const VehicleProfile& vehicle,
+    double& oldCrowDistance, double& newCrowDistance) const
+{
+    vector<DeliveryRequest> plain(deliveries.begin(), deliveries.end());
+    oldCrowDistance = getTotalEuclidian(plain, depot);
+    newCrowDistance = 0;
+    int n = (int)deliveries.size();
+    if(n == 0) return true;
+
+    //matrix index 0 is the depot, delivery i is index i+1
+    vector<GeoCoord> points(1, depot);
+    for(int i = 0; i < n; i++)
+        points.push_back(deliveries[i].location);
+    vector<vector<double> > dist;
+    if(!buildDistanceMatrix(points, dist))
+        return false;
+    //a travel-time layer already gives the matrix in minutes
+    double minutesPerMile = m_weights != nullptr ? 1 : 60 / vehicle.speedMph;
+
+    vector<TimeWindowSegment> stop(n + 2);
+    stop[0] = singleStop(0, vehicle.departureTime, vehicle.returnBy, 0, 0);
+    for(int i = 0; i < n; i++){
+        const TimedDeliveryRequest& r = deliveries[i];
+        stop[i + 1] = singleStop(i + 1, r.windowOpen, r.windowClose, r.serviceTime, r.demand);
+    }
+    stop[n + 1] = singleStop(0, vehicle.departureTime, vehicle.returnBy, 0, 0);
+
+    //route[p] is the stop at position p; the depot sits at both ends. Start from the
+    //deliveries sorted by deadline, which is usually close to feasible already.
+    vector<int> route(n + 2);
+    route[0] = 0;
+    route[n + 1] = n + 1;
+    for(int i = 0; i < n; i++)
+        route[i + 1] = i + 1;
+    sort(route.begin() + 1, route.end() - 1, [&](int a, int b){
+        return deliveries[a - 1].windowClose < deliveries[b - 1].windowClose;
+    });
+
+    //prefix[p] summarizes route positions 0..p and suffix[p] positions p..len-1; both are
+    //rebuilt in O(n) after a move is applied. The run between the two ends of a move is
+    //grown one stop at a time as the loops below walk j, so every candidate is still
+    //priced in O(1) from at most five summaries without an O(n^2) table of them.
+    int len = n + 2;
+    vector<TimeWindowSegment> prefix(len), suffix(len);
+    auto join = [&](const TimeWindowSegment& a, const TimeWindowSegment& b){
+        return concat(a, b, dist, minutesPerMile);
+    };
+    auto at = [&](int p) -> const TimeWindowSegment& { return stop[route[p]]; };
+    auto rebuild = [&](){
+        prefix[0] = at(0);
+        for(int p = 1; p < len; p++)
+            prefix[p] = join(prefix[p - 1], at(p));
+        suffix[len - 1] = at(len - 1);
+        for(int p = len - 2; p >= 0; p--)
+            suffix[p] = join(at(p), suffix[p + 1]);
+    };
+    rebuild();
+
+    bool improved = true;
+    while(improved){
+        improved = false;
+        double bestCost = tourCost(prefix[len - 1]);
+        int bestKind = 0, bestI = 0, bestJ = 0;
+        auto consider = [&](const TimeWindowSegment& s, int kind, int i, int j){
+            if(tourCost(s) < bestCost - 1e-9){
+                bestCost = tourCost(s);
+                bestKind = kind; bestI = i; bestJ = j;
+            }
+        };
+
+        for(int i = 1; i <= n; i++){
+            //relocate: move the stop at position i to just after position j, with the run
+            //between them (positions j+1..i-1, or i+1..j) grown outwards from i
+            TimeWindowSegment between;
+            for(int j = i - 2; j >= 0; j--){
+                between = j == i - 2 ? at(i - 1) : join(at(j + 1), between);
+                consider(join(join(join(prefix[j], at(i)), between), suffix[i + 1]), 1, i, j);
+            }
+            for(int j = i + 1; j <= n; j++){
+                between = j == i + 1 ? at(i + 1) : join(between, at(j));
+                consider(join(join(join(prefix[i - 1], between), at(i)), suffix[j + 1]), 1, i, j);
+            }
+            //swap: exchange the stops at positions i and j; between is i+1..j-1
+            if(i < n)
+                consider(join(join(join(prefix[i - 1], at(i + 1)), at(i)), suffix[i + 2]), 2, i, i + 1);
+            for(int j = i + 2; j <= n; j++){
+                between = j == i + 2 ? at(i + 1) : join(between, at(j - 1));
+                consider(join(join(join(join(prefix[i - 1], at(j)), between), at(i)), suffix[j + 1]), 2, i, j);
+            }
+        }
+
+        if(bestKind == 1){
+            int moved = route[bestI];
+            route.erase(route.begin() + bestI);
+            route.insert(route.begin() + (bestJ < bestI ? bestJ + 1 : bestJ), moved);
+        } else if(bestKind == 2){
+            swap(route[bestI], route[bestJ]);
+        }
+        if(bestKind != 0){
+            rebuild();
+            improved = true;
+        }
+    }
+
+    vector<TimedDeliveryRequest> ordered;
+    for(int p = 1; p <= n; p++)
+        ordered.push_back(deliveries[route[p] - 1]);
+    deliveries = ordered;
+
+    const TimeWindowSegment& tour = prefix[len - 1];
+    newCrowDistance = tour.dist;
+    return tour.TW == 0 && tour.load <= vehicle.capacity;
+}
+
+//******************** metrics ************************************************
+
+//runs that finish get their improvement recorded; a cancelled run's best-so-far would skew it,
+//and so would a run over a weight layer, whose total is in minutes against crow-flies miles
+static void recordRun(bool complete, bool inMiles, double oldCrowDistance, double newCrowDistance){
+    if(complete && inMiles && oldCrowDistance > 0 && newCrowDistance >= 0)
+        improvement.observe(newCrowDistance / oldCrowDistance);
+}
+
+bool DeliveryOptimizerImpl::optimizeDeliveryOrder(
+    const GeoCoord& depot, vector<DeliveryRequest>& deliveries,
+    double& oldCrowDistance, double& newCrowDistance,
+    const CancellationToken* token, PlanningContext* legs) const
+{
+    ScopedTimer timer(runSeconds);
+    bool complete = anneal(depot, deliveries, oldCrowDistance, newCrowDistance, token, legs);
+    recordRun(complete, m_weights == nullptr, oldCrowDistance, newCrowDistance);
+    return complete;
+}
+
+bool DeliveryOptimizerImpl::optimizeDeliveryOrder(
+    const GeoCoord& depot, vector<TimedDeliveryRequest>& deliveries,
+    const VehicleProfile& vehicle,
+    double& oldCrowDistance, double& newCrowDistance) const
+{
+    ScopedTimer timer(runSeconds);
+    bool feasible = optimizeWithWindows(depot, deliveries, vehicle, oldCrowDistance, newCrowDistance);
+    recordRun(true, m_weights == nullptr, oldCrowDistance, newCrowDistance);
+    return feasible;
 }
 
 //******************** DeliveryOptimizer functions ****************************
@@ -148,7 +971,11 @@ void DeliveryOptimizerImpl::optimizeDeliveryOrder(
 // You probably don't want to change any of this code.
 
 DeliveryOptimizer::DeliveryOptimizer(const StreetMap* sm){
-    m_impl = new DeliveryOptimizerImpl(sm);
+    m_impl = new DeliveryOptimizerImpl(sm, RoutingOptions());
+}
+
+DeliveryOptimizer::DeliveryOptimizer(const StreetMap* sm, const RoutingOptions& options){
+    m_impl = new DeliveryOptimizerImpl(sm, options);
 }
 
 DeliveryOptimizer::~DeliveryOptimizer(){
@@ -163,6 +990,30 @@ void DeliveryOptimizer::optimizeDeliveryOrder(
     return m_impl->optimizeDeliveryOrder(depot, deliveries, oldCrowDistance, newCrowDistance);
 }
 
+bool DeliveryOptimizer::optimizeDeliveryOrder(
+        const GeoCoord& depot, vector<DeliveryRequest>& deliveries,
+        double& oldCrowDistance, double& newCrowDistance,
+        const CancellationToken& token) const
+{
+    return m_impl->optimizeDeliveryOrder(depot, deliveries, oldCrowDistance, newCrowDistance, &token);
+}
+
+bool DeliveryOptimizer::optimizeDeliveryOrder(
+        const GeoCoord& depot, vector<DeliveryRequest>& deliveries,
+        double& oldCrowDistance, double& newCrowDistance,
+        PlanningContext& legs, const CancellationToken* token) const
+{
+    return m_impl->optimizeDeliveryOrder(depot, deliveries, oldCrowDistance, newCrowDistance, token, &legs);
+}
+
+bool DeliveryOptimizer::optimizeDeliveryOrder(
+        const GeoCoord& depot, vector<TimedDeliveryRequest>& deliveries,
+        const VehicleProfile& vehicle,
+        double& oldCrowDistance, double& newCrowDistance) const
+{
+    return m_impl->optimizeDeliveryOrder(depot, deliveries, vehicle, oldCrowDistance, newCrowDistance);
+}
+
 
 //BELOW FOR TESTING
 //int main(){
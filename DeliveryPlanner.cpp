@@ -1,6 +1,15 @@
 #include "provided.h"
+#include "StreetGraph.h"
+#include "CancellationToken.h"
+#include "Polyline.h"
+#include "PlanningContext.h"
+#include "Metrics.h"
 #include <vector>
 #include <string>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <cmath>
 using namespace std;
 
 class DeliveryPlannerImpl
@@ -12,13 +21,44 @@ public:
         const GeoCoord& depot,
         const vector<DeliveryRequest>& deliveries,
         vector<DeliveryCommand>& commands,
-        double& totalDistanceTravelled) const;
+        double& totalDistanceTravelled,
+        const CancellationToken* token = nullptr,
+        vector<string>* legPolylines = nullptr) const;
+    DeliveryResult generateFleetDeliveryPlan(
+        const GeoCoord& depot,
+        const vector<DeliveryRequest>& deliveries,
+        int numVehicles,
+        vector<vector<DeliveryCommand> >& commands,
+        vector<double>& distances) const;
 private:
+    DeliveryResult planRoute(
+        const GeoCoord& depot,
+        const vector<DeliveryRequest>& deliveries,
+        vector<DeliveryCommand>& commands,
+        double& totalDistanceTravelled,
+        const CancellationToken* token,
+        vector<string>* legPolylines) const;
+    DeliveryResult planFleet(
+        const GeoCoord& depot,
+        const vector<DeliveryRequest>& deliveries,
+        int numVehicles,
+        vector<vector<DeliveryCommand> >& commands,
+        vector<double>& distances) const;
+    DeliveryResult checkDeliveries(const GeoCoord& depot, const vector<DeliveryRequest>& deliveries) const;
+    DeliveryResult generateCommands(
+        const GeoCoord& depot,
+        const vector<DeliveryRequest>& optDeliveries,
+        vector<DeliveryCommand>& commands,
+        double& totalDistance,
+        const CancellationToken* token = nullptr,
+        vector<string>* legPolylines = nullptr,
+        const PlanningContext* legs = nullptr) const;
+    const StreetMap* smap;
     PointToPointRouter ptpr;
     DeliveryOptimizer dopt;
 };
 
-DeliveryPlannerImpl::DeliveryPlannerImpl(const StreetMap* sm) : ptpr(sm), dopt(sm){
+DeliveryPlannerImpl::DeliveryPlannerImpl(const StreetMap* sm) : smap(sm), ptpr(sm), dopt(sm){
 }
 
 DeliveryPlannerImpl::~DeliveryPlannerImpl(){
@@ -45,95 +85,159 @@ string getDirectionFromAngle(double angle){
         return "east";
 }
 
+//rejects a delivery set that can't be planned before any optimizing or routing is done:
+//BAD_COORD if a location isn't on the map, NO_ROUTE if one lies in a different connected
+//component than the depot
+DeliveryResult DeliveryPlannerImpl::checkDeliveries(const GeoCoord& depot, const vector<DeliveryRequest>& deliveries) const{
+    const StreetGraph& g = smap->graph();
+    NodeId depotNode;
+    if(!g.findNode(depot, depotNode))
+        return BAD_COORD;
+    vector<NodeId> nodes(deliveries.size());
+    for(size_t i = 0; i < deliveries.size(); i++){
+        if(!g.findNode(deliveries[i].location, nodes[i]))
+            return BAD_COORD;
+    }
+    for(size_t i = 0; i < nodes.size(); i++){
+        if(!g.connected(depotNode, nodes[i]))
+            return NO_ROUTE;
+    }
+    return DELIVERY_SUCCESS;
+}
+
+static const Counter legsReused("planner_legs_total", "Plan legs by where their route came from",
+                                "source=\"optimizer\"");
+static const Counter legsRouted("planner_legs_total", "Plan legs by where their route came from",
+                                "source=\"routed\"");
+
 //return type: DELIVERY_SUCCESS, NO_ROUTE, BAD_COORD
-DeliveryResult DeliveryPlannerImpl::generateDeliveryPlan(
+DeliveryResult DeliveryPlannerImpl::planRoute(
     const GeoCoord& depot, const vector<DeliveryRequest>& deliveries,
-    vector<DeliveryCommand>& commands, double& totalDistanceTravelled) const
+    vector<DeliveryCommand>& commands, double& totalDistanceTravelled,
+    const CancellationToken* token, vector<string>* legPolylines) const
 {
+    DeliveryResult feasible = checkDeliveries(depot, deliveries);
+    if(feasible != DELIVERY_SUCCESS) return feasible;
     double ocd = 0, ncd = 0, distance = 0;
     vector<DeliveryRequest> optDeliveries(deliveries.begin(), deliveries.end());
-    dopt.optimizeDeliveryOrder(depot, optDeliveries, ocd, ncd);
-    totalDistanceTravelled = ncd;
-    
-    //generate vector of all streetsegments representing delivery path
-    list<StreetSegment> temp;
-    vector<StreetSegment> allRoutes;
+    //the optimizer has already routed every leg of the order it picks
+    PlanningContext legs(smap->graph());
+    dopt.optimizeDeliveryOrder(depot, optDeliveries, ocd, ncd, legs, token);
+    //legs the optimizer already routed cost no search, so the chosen order's plan comes
+    //back whenever they cover it; any other leg is routed under the token, which keeps a
+    //late request's tail bounded and makes it CANCELLED instead
+    DeliveryResult res = generateCommands(depot, optDeliveries, commands, distance, token, legPolylines, &legs);
+    //an optimizer stopped before it measured anything has no distance to report
+    totalDistanceTravelled = ncd >= 0 ? ncd : distance;
+    return res;
+}
+
+//turns an already ordered depot -> deliveries -> depot loop into commands; distance is
+//the sum of the legs' network distances. If legPolylines is given, it gets one encoded
+//polyline per leg, straight from the leg's edge ids. Legs found in legs aren't routed again.
+DeliveryResult DeliveryPlannerImpl::generateCommands(
+    const GeoCoord& depot, const vector<DeliveryRequest>& optDeliveries,
+    vector<DeliveryCommand>& commands, double& totalDistance,
+    const CancellationToken* token, vector<string>* legPolylines,
+    const PlanningContext* legs) const
+{
+    totalDistance = 0;
+    if(legPolylines != nullptr) legPolylines->clear();
+    if(optDeliveries.empty()) return DELIVERY_SUCCESS;
+    double distance = 0;
+
+    //generate the edge ids of the whole delivery path
+    const StreetGraph& g = smap->graph();
+    RouteArena arena;
+    EdgePath temp;
+    vector<EdgeId> allRoutes;
     DeliveryResult res;
-    for(int i = 0; i < optDeliveries.size(); i++){
-        if(i == 0){
-            res = ptpr.generatePointToPointRoute(depot, optDeliveries[i].location, temp, distance);
-            if(res == NO_ROUTE) return NO_ROUTE;
-            if(res == BAD_COORD) return BAD_COORD;
-        } else {
-            res = ptpr.generatePointToPointRoute(optDeliveries[i-1].location, optDeliveries[i].location, temp, distance);
-            if(res == NO_ROUTE) return NO_ROUTE;
-            if(res == BAD_COORD) return BAD_COORD;
+    for(size_t i = 0; i <= optDeliveries.size(); i++){
+        const GeoCoord& from = i == 0 ? depot : optDeliveries[i-1].location;
+        const GeoCoord& to = i == optDeliveries.size() ? depot : optDeliveries[i].location;
+        size_t legStart = allRoutes.size();
+        NodeId a, b;
+        if(legs == nullptr || !g.findNode(from, a) || !g.findNode(to, b) || !legs->appendLeg(a, b, allRoutes, distance)){
+            if(token == nullptr)
+                res = ptpr.generatePointToPointRoute(from, to, arena, temp, distance);
+            else
+                res = ptpr.generatePointToPointRoute(from, to, arena, temp, distance, *token);
+            if(res != DELIVERY_SUCCESS) return res;
+            allRoutes.insert(allRoutes.end(), temp.begin(), temp.end());
+            legsRouted.add();
+        } else
+            legsReused.add();
+        if(legPolylines != nullptr){
+            legPolylines->push_back(string());
+            encodePolyline(g, EdgePath(allRoutes.data() + legStart, allRoutes.size() - legStart), legPolylines->back());
         }
-        for(auto j = temp.begin(); j != temp.end(); j++)
-            allRoutes.push_back((*j));
+        totalDistance += distance;
     }
-    res = ptpr.generatePointToPointRoute(optDeliveries[optDeliveries.size()-1].location, depot, temp, distance);
-    if(res == NO_ROUTE) return NO_ROUTE;
-    if(res == BAD_COORD) return BAD_COORD;
-    for(auto j = temp.begin(); j != temp.end(); j++)
-        allRoutes.push_back((*j));
 
     if(allRoutes.size() == 0) return NO_ROUTE;
+
+    //street names are compared by their pooled id and only turned into strings for commands
+    vector<NodeId> deliveryNodes(optDeliveries.size());
+    for(size_t i = 0; i < optDeliveries.size(); i++)
+        g.findNode(optDeliveries[i].location, deliveryNodes[i]);
     
     //loop over point-to-point street segments, generate DeliveryCommands
-    string prevStreetName = allRoutes[0].name;
+    NameId prevStreetName = g.edgeNameId(allRoutes[0]);
     double streetDis = 0;
-    int curDeliveryNum = 0;
-    DeliveryRequest curDeliveryRequest = optDeliveries[curDeliveryNum];
-    double startAngle = angleOfLine(allRoutes[0]);
+    size_t curDeliveryNum = 0;
+    size_t curDeliveryRequest = 0;
+    double startAngle = g.edgeAngle(allRoutes[0]);
     
-    for(int i = 0; i < allRoutes.size(); i++){
+    for(size_t i = 0; i < allRoutes.size(); i++){
         //3 CASES:
         //((1) on same street, issue no delivery commands, add distance
         // (2) at delivery location, issue proceed command on current road with current distance, issue delivery command, reset distance/angle
         // (3) at new street, issue proceed command for previous street, likely issue turn command onto new street, reset distance/angle/prevStreet
         DeliveryCommand proc, turn, deliver;
-        if(allRoutes[i].start == curDeliveryRequest.location){
+        EdgeId e = allRoutes[i];
+        if(g.edgeSource(e) == deliveryNodes[curDeliveryRequest]){
             if(streetDis > 0){
-                proc.initAsProceedCommand(getDirectionFromAngle(startAngle), prevStreetName, streetDis);
+                proc.initAsProceedCommand(getDirectionFromAngle(startAngle), string(g.streetName(prevStreetName)), streetDis, prevStreetName);
                 commands.push_back(proc);
             }
             
-            deliver.initAsDeliverCommand(curDeliveryRequest.item);
+            deliver.initAsDeliverCommand(optDeliveries[curDeliveryRequest].item);
             commands.push_back(deliver);
             curDeliveryNum++;
-            startAngle = angleOfLine(allRoutes[i]);
+            startAngle = g.edgeAngle(e);
             if(curDeliveryNum < optDeliveries.size())
-                curDeliveryRequest = optDeliveries[curDeliveryNum];
+                curDeliveryRequest = curDeliveryNum;
             streetDis = 0;
         }
-        else if(allRoutes[i].name == prevStreetName){
-            streetDis += distanceEarthMiles(allRoutes[i].start, allRoutes[i].end);
+        else if(g.edgeNameId(e) == prevStreetName){
+            streetDis += g.edgeLength(e);
         } else {
             if(streetDis > 0){
-                proc.initAsProceedCommand(getDirectionFromAngle(startAngle), prevStreetName, streetDis);
+                proc.initAsProceedCommand(getDirectionFromAngle(startAngle), string(g.streetName(prevStreetName)), streetDis, prevStreetName);
                 commands.push_back(proc);
             }
             
-            double angleBetweenDiffStreets = angleBetween2Lines(allRoutes[i-1], allRoutes[i]);
+            double angleBetweenDiffStreets = g.edgeAngle(e) - g.edgeAngle(allRoutes[i-1]);
+            if(angleBetweenDiffStreets < 0)
+                angleBetweenDiffStreets += 360;
             if(angleBetweenDiffStreets >= 1 && angleBetweenDiffStreets < 180){
-                turn.initAsTurnCommand("left", allRoutes[i].name);
+                turn.initAsTurnCommand("left", string(g.edgeName(e)), g.edgeNameId(e));
                 commands.push_back(turn);
             }
             else if(angleBetweenDiffStreets >= 180 && angleBetweenDiffStreets <= 359){
-                turn.initAsTurnCommand("right", allRoutes[i].name);
+                turn.initAsTurnCommand("right", string(g.edgeName(e)), g.edgeNameId(e));
                 commands.push_back(turn);
             }
       
             streetDis = 0;
-            prevStreetName = allRoutes[i].name;
-            startAngle = angleOfLine(allRoutes[i]);
-            streetDis += distanceEarthMiles(allRoutes[i].start, allRoutes[i].end);
+            prevStreetName = g.edgeNameId(e);
+            startAngle = g.edgeAngle(e);
+            streetDis += g.edgeLength(e);
             
         }
         
         if(i == allRoutes.size() - 1){
-            proc.initAsProceedCommand(getDirectionFromAngle(startAngle), prevStreetName, streetDis);
+            proc.initAsProceedCommand(getDirectionFromAngle(startAngle), string(g.streetName(prevStreetName)), streetDis, prevStreetName);
             commands.push_back(proc);
         }
     }
@@ -143,6 +247,218 @@ DeliveryResult DeliveryPlannerImpl::generateDeliveryPlan(
 }
 
 
+//******************** fleet mode *********************************************
+
+//Routes below hold distance matrix indices: 0 is the depot and delivery i is i+1. Every
+//street segment is stored in both directions, so the matrix is symmetric and reversing part
+//of a route doesn't change its length except at the two cut points.
+
+//extra distance for putting stop into route at its cheapest spot, which is returned in pos
+static double cheapestInsertion(const vector<int>& route, int stop, const vector<vector<double> >& dist, int& pos){
+    double best = 0;
+    pos = -1;
+    for(size_t i = 0; i <= route.size(); i++){
+        int p = i > 0 ? route[i - 1] : 0;
+        int q = i < route.size() ? route[i] : 0;
+        double added = dist[p][stop] + dist[stop][q] - dist[p][q];
+        if(pos < 0 || added < best){
+            best = added;
+            pos = (int)i;
+        }
+    }
+    return best;
+}
+
+static double removalGain(const vector<int>& route, int i, const vector<vector<double> >& dist){
+    int p = i > 0 ? route[i - 1] : 0;
+    int q = i + 1 < (int)route.size() ? route[i + 1] : 0;
+    return dist[p][route[i]] + dist[route[i]][q] - dist[p][q];
+}
+
+static void twoOpt(vector<int>& route, const vector<vector<double> >& dist){
+    int n = (int)route.size();
+    bool improved = true;
+    while(improved){
+        improved = false;
+        for(int i = 0; i < n - 1; i++){
+            for(int j = i + 1; j < n; j++){
+                int p = i > 0 ? route[i - 1] : 0;
+                int q = j + 1 < n ? route[j + 1] : 0;
+                double change = dist[p][route[j]] + dist[route[i]][q] - dist[p][route[i]] - dist[route[j]][q];
+                if(change < -1e-9){
+                    reverse(route.begin() + i, route.begin() + j + 1);
+                    improved = true;
+                }
+            }
+        }
+    }
+}
+
+//Splits the deliveries across numVehicles loops that all start and end at the depot.
+//Stops are swept by bearing from the depot into sectors of at most ceil(N/K) stops,
+//starting at the widest empty wedge so no natural cluster is cut in two. Relocate and
+//exchange moves between vehicles then shorten the total as long as they can, keeping
+//every vehicle under the same stop cap so the work stays balanced. The per-vehicle
+//commands are generated on separate threads, since each needs its own set of searches.
+DeliveryResult DeliveryPlannerImpl::planFleet(
+    const GeoCoord& depot, const vector<DeliveryRequest>& deliveries, int numVehicles,
+    vector<vector<DeliveryCommand> >& commands, vector<double>& distances) const
+{
+    if(numVehicles < 1) numVehicles = 1;
+    commands.assign(numVehicles, vector<DeliveryCommand>());
+    distances.assign(numVehicles, 0);
+    int n = (int)deliveries.size();
+    if(n == 0) return DELIVERY_SUCCESS;
+    DeliveryResult feasible = checkDeliveries(depot, deliveries);
+    if(feasible != DELIVERY_SUCCESS) return feasible;
+
+    vector<GeoCoord> points(1, depot);
+    for(int i = 0; i < n; i++)
+        points.push_back(deliveries[i].location);
+    vector<vector<double> > dist;
+    if(ptpr.generateDistanceMatrix(points, points, dist) != DELIVERY_SUCCESS)
+        return BAD_COORD;
+    for(int i = 0; i <= n; i++){
+        for(int j = 0; j <= n; j++)
+            if(dist[i][j] < 0) return NO_ROUTE;
+    }
+
+    //sweep
+    vector<double> bearing(n);
+    vector<int> order(n);
+    for(int i = 0; i < n; i++){
+        bearing[i] = atan2(deliveries[i].location.latitude - depot.latitude,
+                           deliveries[i].location.longitude - depot.longitude);
+        order[i] = i;
+    }
+    sort(order.begin(), order.end(), [&](int a, int b){ return bearing[a] < bearing[b]; });
+    int startAt = 0;
+    double widestGap = -1;
+    for(int i = 0; i < n; i++){
+        double gap = bearing[order[i]] - bearing[order[(i + n - 1) % n]];
+        if(gap <= 0) gap += 2 * M_PI;
+        if(gap > widestGap){
+            widestGap = gap;
+            startAt = i;
+        }
+    }
+    rotate(order.begin(), order.begin() + startAt, order.end());
+
+    int cap = (n + numVehicles - 1) / numVehicles;
+    vector<vector<int> > routes(numVehicles);
+    for(int i = 0; i < n; i++){
+        vector<int>& r = routes[i / cap];
+        int pos;
+        cheapestInsertion(r, order[i] + 1, dist, pos);
+        r.insert(r.begin() + pos, order[i] + 1);
+    }
+    for(int v = 0; v < numVehicles; v++)
+        twoOpt(routes[v], dist);
+
+    //inter-route relocate and exchange, first improvement
+    bool improved = true;
+    while(improved){
+        improved = false;
+        for(int a = 0; a < numVehicles; a++){
+            for(int i = 0; i < (int)routes[a].size(); i++){
+                int x = routes[a][i];
+                for(int b = 0; b < numVehicles && !improved; b++){
+                    if(b == a) continue;
+                    if((int)routes[b].size() < cap){
+                        int pos;
+                        double change = cheapestInsertion(routes[b], x, dist, pos) - removalGain(routes[a], i, dist);
+                        if(change < -1e-9){
+                            routes[a].erase(routes[a].begin() + i);
+                            routes[b].insert(routes[b].begin() + pos, x);
+                            improved = true;
+                            break;
+                        }
+                    }
+                    for(int j = 0; j < (int)routes[b].size(); j++){
+                        int y = routes[b][j];
+                        int pa = i > 0 ? routes[a][i - 1] : 0;
+                        int qa = i + 1 < (int)routes[a].size() ? routes[a][i + 1] : 0;
+                        int pb = j > 0 ? routes[b][j - 1] : 0;
+                        int qb = j + 1 < (int)routes[b].size() ? routes[b][j + 1] : 0;
+                        double change = dist[pa][y] + dist[y][qa] - dist[pa][x] - dist[x][qa]
+                                      + dist[pb][x] + dist[x][qb] - dist[pb][y] - dist[y][qb];
+                        if(change < -1e-9){
+                            swap(routes[a][i], routes[b][j]);
+                            improved = true;
+                            break;
+                        }
+                    }
+                }
+                if(improved) break;
+            }
+            if(improved){
+                for(int v = 0; v < numVehicles; v++)
+                    twoOpt(routes[v], dist);
+                break;
+            }
+        }
+    }
+
+    //one worker per core pulls vehicles off a shared counter
+    vector<vector<DeliveryRequest> > ordered(numVehicles);
+    for(int v = 0; v < numVehicles; v++)
+        for(size_t i = 0; i < routes[v].size(); i++)
+            ordered[v].push_back(deliveries[routes[v][i] - 1]);
+    vector<DeliveryResult> results(numVehicles, DELIVERY_SUCCESS);
+    atomic<int> nextVehicle(0);
+    auto work = [&](){
+        for(int v = nextVehicle++; v < numVehicles; v = nextVehicle++)
+            results[v] = generateCommands(depot, ordered[v], commands[v], distances[v]);
+    };
+    int numThreads = min(numVehicles, max(1, (int)thread::hardware_concurrency()));
+    vector<thread> workers;
+    for(int t = 1; t < numThreads; t++)
+        workers.push_back(thread(work));
+    work();
+    for(size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
+
+    for(int v = 0; v < numVehicles; v++)
+        if(results[v] != DELIVERY_SUCCESS) return results[v];
+    return DELIVERY_SUCCESS;
+}
+
+
+//******************** metrics ************************************************
+
+static const Histogram planSeconds("planner_plan_seconds", "Time to build a delivery plan",
+                                   Histogram::latencyBuckets(), "kind=\"single\"");
+static const Histogram fleetSeconds("planner_plan_seconds", "Time to build a delivery plan",
+                                    Histogram::latencyBuckets(), "kind=\"fleet\"");
+//one series per DeliveryResult, in enum order
+static const Counter planResults[] = {
+    Counter("planner_plans_total", "Delivery plans by result", "result=\"success\""),
+    Counter("planner_plans_total", "Delivery plans by result", "result=\"no_route\""),
+    Counter("planner_plans_total", "Delivery plans by result", "result=\"bad_coord\""),
+    Counter("planner_plans_total", "Delivery plans by result", "result=\"cancelled\""),
+};
+
+DeliveryResult DeliveryPlannerImpl::generateDeliveryPlan(
+    const GeoCoord& depot, const vector<DeliveryRequest>& deliveries,
+    vector<DeliveryCommand>& commands, double& totalDistanceTravelled,
+    const CancellationToken* token, vector<string>* legPolylines) const
+{
+    ScopedTimer timer(planSeconds);
+    DeliveryResult res = planRoute(depot, deliveries, commands, totalDistanceTravelled, token, legPolylines);
+    planResults[res].add();
+    return res;
+}
+
+DeliveryResult DeliveryPlannerImpl::generateFleetDeliveryPlan(
+    const GeoCoord& depot, const vector<DeliveryRequest>& deliveries, int numVehicles,
+    vector<vector<DeliveryCommand> >& commands, vector<double>& distances) const
+{
+    ScopedTimer timer(fleetSeconds);
+    DeliveryResult res = planFleet(depot, deliveries, numVehicles, commands, distances);
+    planResults[res].add();
+    return res;
+}
+
 //******************** DeliveryPlanner functions ******************************
 
 // These functions simply delegate to DeliveryPlannerImpl's functions.
@@ -167,6 +483,36 @@ DeliveryResult DeliveryPlanner::generateDeliveryPlan(
     return m_impl->generateDeliveryPlan(depot, deliveries, commands, totalDistanceTravelled);
 }
 
+DeliveryResult DeliveryPlanner::generateDeliveryPlan(
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    vector<DeliveryCommand>& commands,
+    double& totalDistanceTravelled,
+    const CancellationToken& token) const
+{
+    return m_impl->generateDeliveryPlan(depot, deliveries, commands, totalDistanceTravelled, &token);
+}
+
+DeliveryResult DeliveryPlanner::generateDeliveryPlan(
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    vector<DeliveryCommand>& commands,
+    double& totalDistanceTravelled,
+    vector<string>& legPolylines) const
+{
+    return m_impl->generateDeliveryPlan(depot, deliveries, commands, totalDistanceTravelled, nullptr, &legPolylines);
+}
+
+DeliveryResult DeliveryPlanner::generateFleetDeliveryPlan(
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    int numVehicles,
+    vector<vector<DeliveryCommand> >& commands,
+    vector<double>& distances) const
+{
+    return m_impl->generateFleetDeliveryPlan(depot, deliveries, numVehicles, commands, distances);
+}
+
 //BELOW FOR TESTING
 //int main() {
 //    StreetMap sm;
@@ -0,0 +1,242 @@
+#include "DeliverySession.h"
+#include <vector>
+#include <map>
+#include <algorithm>
+using namespace std;
+
+class DeliverySessionImpl
+{
+public:
+    DeliverySessionImpl(const StreetMap* sm, const GeoCoord& depot);
+    ~DeliverySessionImpl();
+    DeliveryResult addStop(const DeliveryRequest& stop, int& stopId);
+    bool removeStop(int stopId);
+    bool markDelivered(int stopId);
+    void currentTour(vector<DeliveryRequest>& stops, vector<int>& stopIds) const;
+    double remainingDistance() const;
+private:
+    //Every location the session knows about lives in a slot: slot 0 is the depot, the
+    //driver's position is m_position, and the rest are pending stops. m_dist is indexed
+    //by slot and freed slots are reused, so the matrix only grows with the number of
+    //stops alive at once, not with the number ever added.
+    PointToPointRouter ptpr;
+    vector<DeliveryRequest> m_slots;
+    vector<int> m_slotStop;             // stop id in each slot, -1 if the slot is free
+    vector<vector<double> > m_dist;
+    vector<int> m_tour;                 // pending slots in visiting order
+    map<int, int> m_stopSlot;
+    int m_position;
+    int m_nextStopId;
+
+    int takeSlot(const DeliveryRequest& stop);
+    void freeSlot(int slot);
+    double d(int a, int b) const { return m_dist[a][b]; }
+    int before(int i) const { return i > 0 ? m_tour[i - 1] : m_position; }
+    int after(int i) const { return i + 1 < (int)m_tour.size() ? m_tour[i + 1] : 0; }
+    void improveTour();
+};
+
+DeliverySessionImpl::DeliverySessionImpl(const StreetMap* sm, const GeoCoord& depot)
+ : ptpr(sm), m_position(0), m_nextStopId(0){
+    m_slots.push_back(DeliveryRequest("", depot));
+    m_slotStop.push_back(-1);
+    m_dist.assign(1, vector<double>(1, 0));
+}
+
+DeliverySessionImpl::~DeliverySessionImpl(){
+}
+
+int DeliverySessionImpl::takeSlot(const DeliveryRequest& stop){
+    for(size_t s = 1; s < m_slots.size(); s++){
+        if(m_slotStop[s] < 0 && (int)s != m_position){
+            m_slots[s] = stop;
+            return (int)s;
+        }
+    }
+    m_slots.push_back(stop);
+    m_slotStop.push_back(-1);
+    for(size_t s = 0; s < m_dist.size(); s++)
+        m_dist[s].push_back(0);
+    m_dist.push_back(vector<double>(m_slots.size(), 0));
+    return (int)m_slots.size() - 1;
+}
+
+void DeliverySessionImpl::freeSlot(int slot){
+    if(slot != 0)
+        m_slotStop[slot] = -1;
+}
+
+DeliveryResult DeliverySessionImpl::addStop(const DeliveryRequest& stop, int& stopId){
+    //one search from the new stop reaches every slot still in use; the streets run both
+    //ways, so it fills the new slot's row and column together
+    vector<int> live(1, 0);
+    vector<GeoCoord> targets(1, m_slots[0].location);
+    for(size_t s = 1; s < m_slots.size(); s++){
+        if(m_slotStop[s] >= 0 || (int)s == m_position){
+            live.push_back((int)s);
+            targets.push_back(m_slots[s].location);
+        }
+    }
+    vector<double> row;
+    DeliveryResult res = ptpr.generateDistancesFrom(stop.location, targets, row);
+    if(res != DELIVERY_SUCCESS)
+        return res;
+    for(size_t i = 0; i < row.size(); i++)
+        if(row[i] < 0) return NO_ROUTE;
+
+    int slot = takeSlot(stop);
+    for(size_t i = 0; i < live.size(); i++){
+        m_dist[slot][live[i]] = row[i];
+        m_dist[live[i]][slot] = row[i];
+    }
+    m_dist[slot][slot] = 0;
+    stopId = m_nextStopId++;
+    m_slotStop[slot] = stopId;
+    m_stopSlot[stopId] = slot;
+
+    //cheapest insertion, then let local search clean up around it
+    int bestPos = 0;
+    double bestAdded = 0;
+    for(int i = 0; i <= (int)m_tour.size(); i++){
+        int p = i > 0 ? m_tour[i - 1] : m_position;
+        int q = i < (int)m_tour.size() ? m_tour[i] : 0;
+        double added = d(p, slot) + d(slot, q) - d(p, q);
+        if(i == 0 || added < bestAdded){
+            bestAdded = added;
+            bestPos = i;
+        }
+    }
+    m_tour.insert(m_tour.begin() + bestPos, slot);
+    improveTour();
+    return DELIVERY_SUCCESS;
+}
+
+bool DeliverySessionImpl::removeStop(int stopId){
+    auto it = m_stopSlot.find(stopId);
+    if(it == m_stopSlot.end())
+        return false;
+    int slot = it->second;
+    m_tour.erase(find(m_tour.begin(), m_tour.end(), slot));
+    m_stopSlot.erase(it);
+    freeSlot(slot);
+    improveTour();
+    return true;
+}
+
+bool DeliverySessionImpl::markDelivered(int stopId){
+    auto it = m_stopSlot.find(stopId);
+    if(it == m_stopSlot.end())
+        return false;
+    int slot = it->second;
+    m_tour.erase(find(m_tour.begin(), m_tour.end(), slot));
+    m_stopSlot.erase(it);
+    //the old position is no longer needed; the delivered stop's slot becomes the new one
+    int oldPosition = m_position;
+    m_position = slot;
+    m_slotStop[slot] = -1;
+    freeSlot(oldPosition);
+    improveTour();
+    return true;
+}
+
+//2-opt and or-opt (moving runs of up to three stops) on the open path
+//position -> tour -> depot, first improvement until neither finds anything. After a single
+//insertion or removal the tour is nearly optimal already, so this settles in a few passes.
+void DeliverySessionImpl::improveTour(){
+    int n = (int)m_tour.size();
+    bool improved = true;
+    while(improved){
+        improved = false;
+        for(int i = 0; i < n - 1 && !improved; i++){
+            for(int j = i + 1; j < n; j++){
+                int p = before(i), q = after(j);
+                double change = d(p, m_tour[j]) + d(m_tour[i], q) - d(p, m_tour[i]) - d(m_tour[j], q);
+                if(change < -1e-9){
+                    reverse(m_tour.begin() + i, m_tour.begin() + j + 1);
+                    improved = true;
+                    break;
+                }
+            }
+        }
+        for(int len = 1; len <= 3 && !improved; len++){
+            for(int i = 0; i + len <= n && !improved; i++){
+                int first = m_tour[i], last = m_tour[i + len - 1];
+                int p = before(i), q = after(i + len - 1);
+                double gain = d(p, first) + d(last, q) - d(p, q);
+                //put the run between positions j-1 and j of the tour without it
+                vector<int> rest(m_tour.begin(), m_tour.begin() + i);
+                rest.insert(rest.end(), m_tour.begin() + i + len, m_tour.end());
+                for(int j = 0; j <= (int)rest.size(); j++){
+                    if(j == i) continue;
+                    int a = j > 0 ? rest[j - 1] : m_position;
+                    int b = j < (int)rest.size() ? rest[j] : 0;
+                    double added = d(a, first) + d(last, b) - d(a, b);
+                    if(added - gain < -1e-9){
+                        rest.insert(rest.begin() + j, m_tour.begin() + i, m_tour.begin() + i + len);
+                        m_tour = rest;
+                        improved = true;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+}
+
+void DeliverySessionImpl::currentTour(vector<DeliveryRequest>& stops, vector<int>& stopIds) const{
+    stops.clear();
+    stopIds.clear();
+    for(size_t i = 0; i < m_tour.size(); i++){
+        stops.push_back(m_slots[m_tour[i]]);
+        stopIds.push_back(m_slotStop[m_tour[i]]);
+    }
+}
+
+double DeliverySessionImpl::remainingDistance() const{
+    double total = 0;
+    int prev = m_position;
+    for(size_t i = 0; i < m_tour.size(); i++){
+        total += d(prev, m_tour[i]);
+        prev = m_tour[i];
+    }
+    return total + d(prev, 0);
+}
+
+//******************** DeliverySession functions ******************************
+
+// These functions simply delegate to DeliverySessionImpl's functions.
+
+DeliverySession::DeliverySession(const StreetMap* sm, const GeoCoord& depot)
+{
+    m_impl = new DeliverySessionImpl(sm, depot);
+}
+
+DeliverySession::~DeliverySession()
+{
+    delete m_impl;
+}
+
+DeliveryResult DeliverySession::addStop(const DeliveryRequest& stop, int& stopId)
+{
+    return m_impl->addStop(stop, stopId);
+}
+
+bool DeliverySession::removeStop(int stopId)
+{
+    return m_impl->removeStop(stopId);
+}
+
+bool DeliverySession::markDelivered(int stopId)
+{
+    return m_impl->markDelivered(stopId);
+}
+
+void DeliverySession::currentTour(vector<DeliveryRequest>& stops, vector<int>& stopIds) const
+{
+    m_impl->currentTour(stops, stopIds);
+}
+
+double DeliverySession::remainingDistance() const
+{
+    return m_impl->remainingDistance();
+}
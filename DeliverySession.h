@@ -0,0 +1,40 @@
+#ifndef DELIVERYSESSION_INCLUDED
+#define DELIVERYSESSION_INCLUDED
+
+#include "provided.h"
+#include <string>
+#include <vector>
+
+// DeliverySession.h
+
+// A planning session for one driver who is already out on the road.  The session keeps
+// the network distances between every stop it has seen and the current visiting order,
+// so adding, cancelling or completing a stop only costs one one-to-many search plus a
+// local repair of the tour rather than a fresh optimizeDeliveryOrder.
+
+class DeliverySessionImpl;
+
+class DeliverySession
+{
+public:
+    DeliverySession(const StreetMap* sm, const GeoCoord& depot);
+    ~DeliverySession();
+      // inserts a stop into the tour; stopId identifies it in later calls.  A stop that
+      // isn't on the map (BAD_COORD) or can't be reached (NO_ROUTE) is not added.
+    DeliveryResult addStop(const DeliveryRequest& stop, int& stopId);
+      // cancels a pending stop; false if stopId isn't pending
+    bool removeStop(int stopId);
+      // the driver has just delivered stopId, so the rest of the tour starts from there
+    bool markDelivered(int stopId);
+      // pending stops in visiting order, and the distance from the driver's position
+      // through all of them and back to the depot
+    void currentTour(std::vector<DeliveryRequest>& stops, std::vector<int>& stopIds) const;
+    double remainingDistance() const;
+      // We prevent a DeliverySession object from being copied or assigned.
+    DeliverySession(const DeliverySession&) = delete;
+    DeliverySession& operator=(const DeliverySession&) = delete;
+private:
+    DeliverySessionImpl* m_impl;
+};
+
+#endif // DELIVERYSESSION_INCLUDED
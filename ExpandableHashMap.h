@@ -1,3 +1,6 @@
+#ifndef EXPANDABLEHASHMAP_INCLUDED
+#define EXPANDABLEHASHMAP_INCLUDED
+
 #include <list>
 #include <string>
 #include <functional>
@@ -6,6 +9,10 @@
 
 // Skeleton for the ExpandableHashMap class template.  You must implement the first six
 // member functions.
+//
+// Thread safety: the map holds no hidden mutable state, so any number of threads may call
+// the const members at once as long as nobody modifies it.  freeze() makes that explicit:
+// once frozen, associate() refuses to change anything and only reads remain.
 
 template<typename KeyType, typename ValueType>
 class ExpandableHashMap {
@@ -14,16 +21,23 @@ public:
     ~ExpandableHashMap();
     //void reset();
     int size() const;
-    void associate(const KeyType& key, const ValueType& value);
+    int bucketCount() const { return curSize; }
+      // bytes used per association and per bucket, for memory reports
+    static size_t entryBytes() { return sizeof(Entry) + 2 * sizeof(void*); }
+    static size_t bucketBytes() { return sizeof(std::list<Entry>); }
+      // returns false, and leaves the map unchanged, if it is frozen
+    bool associate(const KeyType& key, const ValueType& value);
 
       // for a map that can't be modified, return a pointer to const ValueType
     const ValueType* find(const KeyType& key) const;
 
-      // for a modifiable map, return a pointer to modifiable ValueType
-    ValueType* find(const KeyType& key)
-    {
-        return const_cast<ValueType*>(const_cast<const ExpandableHashMap*>(this)->find(key));
-    }
+      // for a modifiable map, return a pointer to modifiable ValueType.  A frozen map is
+      // shared with concurrent readers, so hand it out only as a const reference and it
+      // never reaches this overload.
+    ValueType* find(const KeyType& key);
+
+    void freeze() { frozen = true; }
+    bool isFrozen() const { return frozen; }
 
       // C++11 syntax for preventing copying and assignment
     ExpandableHashMap(const ExpandableHashMap&) = delete;
@@ -40,14 +54,15 @@ private:
     double loadFactor;
     int curSize;
     int numAssocs;
+    bool frozen;
     std::list<Entry> *map;
     void rehash();
-    int mapFunc(KeyType key) const;
+    int mapFunc(const KeyType& key) const;
 };
 
 //returns bucket number for a given key
 template<typename KeyType, typename ValueType>
-int ExpandableHashMap<KeyType, ValueType>::mapFunc(KeyType key) const{
+int ExpandableHashMap<KeyType, ValueType>::mapFunc(const KeyType& key) const{
     unsigned int hasher(const KeyType& k);
     return hasher(key) % curSize;
     
@@ -60,6 +75,7 @@ ExpandableHashMap<KeyType, ValueType>::ExpandableHashMap(double maximumLoadFacto
     this->curSize = 8;
     this->numAssocs = 0;
     this->loadFactor = maximumLoadFactor;
+    this->frozen = false;
     this->map = new std::list<Entry>[8];
 }
 
@@ -84,12 +100,14 @@ int ExpandableHashMap<KeyType, ValueType>::size() const{
 }
 
 template<typename KeyType, typename ValueType>
-void ExpandableHashMap<KeyType, ValueType>::associate(const KeyType& key, const ValueType& value){
+bool ExpandableHashMap<KeyType, ValueType>::associate(const KeyType& key, const ValueType& value){
+    if(frozen)
+        return false;
     int bucketNum = mapFunc(key);
     for(auto it = map[bucketNum].begin(); it != map[bucketNum].end(); it++){
         if((*it).key == key){
             (*it).value = value;
-            return;
+            return true;
         }
     }
     this->map[bucketNum].push_front(Entry(key, value));
@@ -98,6 +116,7 @@ void ExpandableHashMap<KeyType, ValueType>::associate(const KeyType& key, const
     if((double)numAssocs/curSize > loadFactor){
         rehash();
     }
+    return true;
 }
 
 template<typename KeyType, typename ValueType>
@@ -112,11 +131,18 @@ const ValueType* ExpandableHashMap<KeyType, ValueType>::find(const KeyType& key)
     return nullptr;
 }
 
+template<typename KeyType, typename ValueType>
+ValueType* ExpandableHashMap<KeyType, ValueType>::find(const KeyType& key){
+    const ExpandableHashMap& self = *this;
+    return const_cast<ValueType*>(self.find(key));
+}
+
 template<typename KeyType, typename ValueType>
 void ExpandableHashMap<KeyType, ValueType>::rehash() {
     this->numAssocs = 0;
     this->curSize *=2;
-    std::list<Entry> *temp = new std::list<Entry>[curSize];
+    //the bucket count only ever doubles from 8, so it stays positive
+    std::list<Entry> *temp = new std::list<Entry>[(unsigned int)curSize];
     
     for(int i = 0; i < curSize/2; i++){
         for(auto it = map[i].begin(); it != map[i].end(); it++){
@@ -131,4 +157,4 @@ void ExpandableHashMap<KeyType, ValueType>::rehash() {
     this->map = temp;
 }
 
-
+#endif // EXPANDABLEHASHMAP_INCLUDED
@@ -0,0 +1,227 @@
+#include "LargePages.h"
+#include <fstream>
+#include <string>
+#include <mutex>
+#include <unordered_map>
+#include <algorithm>
+#include <stdexcept>
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <unistd.h>
+#include <sched.h>
+#endif
+using namespace std;
+
+// LargePages.cpp
+
+//smaller blocks aren't worth a mapping of their own
+static const size_t MAPPED_MIN = 64 * 1024;
+static const size_t HUGE_PAGE = 2 * 1024 * 1024;
+
+//every mapped byte, by kind
+static mutex s_lock;
+static LargePageStats s_stats = { 0, 0, 0 };
+
+#if defined(__linux__)
+
+enum MappingKind { PLAIN_MAPPING, EXPLICIT_HUGE, TRANSPARENT_HUGE };
+
+struct Mapping {
+    size_t bytes;
+    MappingKind kind;
+    bool bound;
+};
+
+//every live mapping, so frees can be counted against the right kind; blocks are only
+//allocated while a map loads, so the lock is never contended in routing
+static unordered_map<void*, Mapping>& mappings(){
+    static unordered_map<void*, Mapping> m;
+    return m;
+}
+
+static bool isMapped(size_t bytes, const LargePagePolicy& policy){
+    return (policy.hugePages || policy.numaNode >= 0) && bytes >= MAPPED_MIN;
+}
+
+static size_t mappedLength(size_t bytes, const LargePagePolicy& policy){
+    size_t unit = policy.hugePages && bytes >= HUGE_PAGE ? HUGE_PAGE : (size_t)sysconf(_SC_PAGESIZE);
+    return (bytes + unit - 1) / unit * unit;
+}
+
+//transparent huge pages only back 2 MB aligned ranges, so map a little extra and trim
+static void* mapAligned(size_t length){
+    size_t padded = length + HUGE_PAGE;
+    char* raw = (char*)mmap(nullptr, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(raw == MAP_FAILED)
+        return nullptr;
+    char* start = (char*)(((size_t)raw + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE);
+    if(start > raw)
+        munmap(raw, start - raw);
+    char* end = start + length;
+    if(end < raw + padded)
+        munmap(end, raw + padded - end);
+    return start;
+}
+
+//preferred rather than strict, so a node that runs out of memory spills to another
+static bool bindToNode(void* p, size_t length, int node){
+    const int words = 16;
+    unsigned long mask[words] = { 0 };
+    const int bitsPerWord = 8 * sizeof(unsigned long);
+    if(node < 0 || node >= words * bitsPerWord)
+        return false;
+    mask[node / bitsPerWord] = 1UL << (node % bitsPerWord);
+    return syscall(SYS_mbind, p, length, MPOL_PREFERRED, mask, (unsigned long)(words * bitsPerWord), 0) == 0;
+}
+
+void* allocateLarge(size_t bytes, const LargePagePolicy& policy){
+    if(!isMapped(bytes, policy))
+        return ::operator new(bytes);
+    size_t length = mappedLength(bytes, policy);
+    Mapping m = { length, PLAIN_MAPPING, false };
+    void* p = MAP_FAILED;
+    if(policy.hugePages && length % HUGE_PAGE == 0){
+        p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(p != MAP_FAILED)
+            m.kind = EXPLICIT_HUGE;
+    }
+    if(p == MAP_FAILED){
+        p = length % HUGE_PAGE == 0 ? mapAligned(length) : mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(p == nullptr || p == MAP_FAILED)
+            throw bad_alloc();
+        if(policy.hugePages && length % HUGE_PAGE == 0 && madvise(p, length, MADV_HUGEPAGE) == 0)
+            m.kind = TRANSPARENT_HUGE;
+    }
+    //nothing has touched the pages yet, so the binding decides where all of them go
+    if(policy.numaNode >= 0)
+        m.bound = bindToNode(p, length, policy.numaNode);
+
+    lock_guard<mutex> guard(s_lock);
+    mappings()[p] = m;
+    if(m.kind == EXPLICIT_HUGE)
+        s_stats.explicitHuge += length;
+    else if(m.kind == TRANSPARENT_HUGE)
+        s_stats.transparent += length;
+    if(m.bound)
+        s_stats.nodeBound += length;
+    return p;
+}
+
+//blocks are only freed when a map is replaced or destroyed, so looking every one up, small
+//ones included, costs nothing that matters
+void freeLarge(void* p, size_t, const LargePagePolicy&){
+    if(p == nullptr)
+        return;
+    Mapping m;
+    bool found;
+    {
+        lock_guard<mutex> guard(s_lock);
+        unordered_map<void*, Mapping>::iterator it = mappings().find(p);
+        found = it != mappings().end();
+        if(found){
+            m = it->second;
+            mappings().erase(it);
+            if(m.kind == EXPLICIT_HUGE)
+                s_stats.explicitHuge -= m.bytes;
+            else if(m.kind == TRANSPARENT_HUGE)
+                s_stats.transparent -= m.bytes;
+            if(m.bound)
+                s_stats.nodeBound -= m.bytes;
+        }
+    }
+    //every mapping is recorded, so a block that isn't one came from operator new
+    if(found)
+        munmap(p, m.bytes);
+    else
+        ::operator delete(p);
+}
+
+//"0-3,8,10-11" style lists from sysfs
+static vector<int> parseList(const string& text){
+    vector<int> values;
+    size_t pos = 0;
+    while(pos < text.size()){
+        size_t end = text.find(',', pos);
+        if(end == string::npos)
+            end = text.size();
+        string part = text.substr(pos, end - pos);
+        size_t dash = part.find('-');
+        try {
+            int first = stoi(part.substr(0, dash));
+            int last = dash == string::npos ? first : stoi(part.substr(dash + 1));
+            for(int v = first; v <= last; v++)
+                values.push_back(v);
+        } catch(const exception&) {
+        }
+        pos = end + 1;
+    }
+    return values;
+}
+
+static vector<int> readList(const string& file){
+    ifstream inf(file);
+    string line;
+    if(!inf || !getline(inf, line))
+        return vector<int>();
+    return parseList(line);
+}
+
+//cpu -> node, read once
+static const vector<int>& cpuNodes(){
+    static const vector<int> table = []{
+        vector<int> t;
+        for(int node : readList("/sys/devices/system/node/has_memory")){
+            for(int cpu : readList("/sys/devices/system/node/node" + to_string(node) + "/cpulist")){
+                if((int)t.size() <= cpu)
+                    t.resize(cpu + 1, 0);
+                t[cpu] = node;
+            }
+        }
+        return t;
+    }();
+    return table;
+}
+
+int numaNodeCount(){
+    static const int count = []{
+        vector<int> nodes = readList("/sys/devices/system/node/has_memory");
+        int highest = 0;
+        for(int n : nodes)
+            highest = max(highest, n);
+        return nodes.empty() ? 1 : highest + 1;
+    }();
+    return count;
+}
+
+int currentNumaNode(){
+    int cpu = sched_getcpu();
+    const vector<int>& table = cpuNodes();
+    return cpu >= 0 && cpu < (int)table.size() ? table[cpu] : 0;
+}
+
+#else
+
+void* allocateLarge(size_t bytes, const LargePagePolicy&){
+    return ::operator new(bytes);
+}
+
+void freeLarge(void* p, size_t, const LargePagePolicy&){
+    ::operator delete(p);
+}
+
+int numaNodeCount(){
+    return 1;
+}
+
+int currentNumaNode(){
+    return 0;
+}
+
+#endif
+
+LargePageStats largePageStats(){
+    lock_guard<mutex> guard(s_lock);
+    return s_stats;
+}
@@ -0,0 +1,85 @@
+#ifndef LARGEPAGES_INCLUDED
+#define LARGEPAGES_INCLUDED
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+// LargePages.h
+
+// Memory for the big read-only arrays of a loaded map.  A plain policy is operator new.
+// Asking for huge pages maps each large block directly, first from the kernel's explicit
+// huge-page pool (MAP_HUGETLB) and, when that is empty or not configured, as ordinary
+// pages advised for transparent huge pages.  Naming a NUMA node binds the block's pages
+// to that node (preferred, so a full node spills over rather than failing).  Whatever the
+// system can't provide is skipped silently; the memory is always there, only possibly
+// slower.  Off Linux every policy is plain.
+
+struct LargePagePolicy
+{
+    LargePagePolicy()
+     : hugePages(false), numaNode(-1)
+    {}
+    bool hugePages;
+    int numaNode;           // -1 for wherever the first writer runs
+};
+
+  // bytes currently mapped by kind, for checking what a policy actually got
+struct LargePageStats
+{
+    size_t explicitHuge;    // from the MAP_HUGETLB pool
+    size_t transparent;     // advised for transparent huge pages
+    size_t nodeBound;       // bound to a NUMA node (counted in one of the above, or neither)
+};
+
+void* allocateLarge(size_t bytes, const LargePagePolicy& policy);
+  // the block is looked up by address, so it's released the way it was allocated even
+  // if policy or bytes don't match
+void freeLarge(void* p, size_t bytes, const LargePagePolicy& policy);
+LargePageStats largePageStats();
+
+  // NUMA nodes with memory, 1 when there is no NUMA or it can't be read
+int numaNodeCount();
+  // node of the CPU the calling thread is on right now, 0 when unknown
+int currentNumaNode();
+
+  // std::vector storage under a LargePagePolicy.  The policy travels with the vector
+  // through copies, moves and swaps.
+template<typename T>
+class LargePageAllocator
+{
+public:
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    LargePageAllocator() {}
+    LargePageAllocator(const LargePagePolicy& policy) : m_policy(policy) {}
+    template<typename U>
+    LargePageAllocator(const LargePageAllocator<U>& other) : m_policy(other.policy()) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(allocateLarge(n * sizeof(T), m_policy)); }
+    void deallocate(T* p, size_t n) { freeLarge(p, n * sizeof(T), m_policy); }
+    const LargePagePolicy& policy() const { return m_policy; }
+
+private:
+    LargePagePolicy m_policy;
+};
+
+template<typename T, typename U>
+bool operator==(const LargePageAllocator<T>& a, const LargePageAllocator<U>& b)
+{
+    return a.policy().hugePages == b.policy().hugePages && a.policy().numaNode == b.policy().numaNode;
+}
+
+template<typename T, typename U>
+bool operator!=(const LargePageAllocator<T>& a, const LargePageAllocator<U>& b)
+{
+    return !(a == b);
+}
+
+template<typename T>
+using LargeVector = std::vector<T, LargePageAllocator<T> >;
+
+#endif // LARGEPAGES_INCLUDED
@@ -0,0 +1,145 @@
+#include "MapHandle.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+using namespace std;
+
+//******************** MapSnapshot functions **********************************
+
+MapSnapshot::MapSnapshot(const StreetMap* sm, unsigned long version)
+ : m_map(sm), m_version(version), m_router(sm), m_optimizer(sm), m_planner(sm){
+}
+
+MapSnapshot::MapSnapshot(unique_ptr<StreetMap> sm, unsigned long version)
+ : m_owned(move(sm)), m_map(m_owned.get()), m_version(version),
+   m_router(m_map), m_optimizer(m_map), m_planner(m_map){
+}
+
+//******************** MapHandle functions ************************************
+
+class MapHandleImpl
+{
+public:
+    MapHandleImpl();
+    ~MapHandleImpl();
+    bool load(string mapFile, const MapLoadOptions& options);
+    future<bool> reloadAsync(string mapFile, const MapLoadOptions& options);
+    shared_ptr<const MapSnapshot> snapshot() const;
+private:
+    //only ever read and written through atomic_load / atomic_store
+    shared_ptr<const MapSnapshot> m_current;
+    //held while a map is built and published, so versions go up in request order
+    mutex m_loadLock;
+    unsigned long m_nextVersion;
+
+    struct Loader {
+        thread worker;
+        shared_ptr<atomic<bool> > done;
+    };
+    vector<Loader> m_loaders;
+    mutex m_loadersLock;
+
+    //background reloads take a ticket when requested and run in ticket order
+    mutex m_turnLock;
+    condition_variable m_turnChanged;
+    unsigned long m_nextTicket;
+    unsigned long m_nowServing;
+};
+
+MapHandleImpl::MapHandleImpl() : m_nextVersion(1), m_nextTicket(0), m_nowServing(0){
+    atomic_store(&m_current, shared_ptr<const MapSnapshot>(
+        make_shared<MapSnapshot>(unique_ptr<StreetMap>(new StreetMap), 0)));
+}
+
+MapHandleImpl::~MapHandleImpl(){
+    lock_guard<mutex> guard(m_loadersLock);
+    for(size_t i = 0; i < m_loaders.size(); i++)
+        m_loaders[i].worker.join();
+}
+
+//the new map is built without touching the published one; readers only notice the
+//final pointer swap
+bool MapHandleImpl::load(string mapFile, const MapLoadOptions& options){
+    lock_guard<mutex> guard(m_loadLock);
+    unique_ptr<StreetMap> sm(new StreetMap);
+    if(!sm->load(mapFile, options))
+        return false;
+    shared_ptr<const MapSnapshot> next = make_shared<MapSnapshot>(move(sm), m_nextVersion++);
+    atomic_store(&m_current, next);
+    return true;
+}
+
+future<bool> MapHandleImpl::reloadAsync(string mapFile, const MapLoadOptions& options){
+    lock_guard<mutex> guard(m_loadersLock);
+    //join loaders that have finished so the list doesn't grow with every reload
+    for(size_t i = 0; i < m_loaders.size(); ){
+        if(*m_loaders[i].done){
+            m_loaders[i].worker.join();
+            m_loaders.erase(m_loaders.begin() + i);
+        } else
+            i++;
+    }
+
+    shared_ptr<promise<bool> > result = make_shared<promise<bool> >();
+    future<bool> f = result->get_future();
+    Loader l;
+    l.done = make_shared<atomic<bool> >(false);
+    shared_ptr<atomic<bool> > done = l.done;
+    unsigned long ticket;
+    {
+        lock_guard<mutex> turn(m_turnLock);
+        ticket = m_nextTicket++;
+    }
+    l.worker = thread([this, mapFile, options, result, done, ticket]{
+        {
+            unique_lock<mutex> turn(m_turnLock);
+            m_turnChanged.wait(turn, [this, ticket]{ return m_nowServing == ticket; });
+        }
+        bool loaded = load(mapFile, options);
+        {
+            lock_guard<mutex> turn(m_turnLock);
+            m_nowServing++;
+        }
+        m_turnChanged.notify_all();
+        result->set_value(loaded);
+        *done = true;
+    });
+    m_loaders.push_back(move(l));
+    return f;
+}
+
+shared_ptr<const MapSnapshot> MapHandleImpl::snapshot() const{
+    return atomic_load(&m_current);
+}
+
+MapHandle::MapHandle()
+{
+    m_impl = new MapHandleImpl;
+}
+
+MapHandle::~MapHandle()
+{
+    delete m_impl;
+}
+
+bool MapHandle::load(string mapFile, const MapLoadOptions& options)
+{
+    return m_impl->load(mapFile, options);
+}
+
+future<bool> MapHandle::reloadAsync(string mapFile, const MapLoadOptions& options)
+{
+    return m_impl->reloadAsync(mapFile, options);
+}
+
+shared_ptr<const MapSnapshot> MapHandle::snapshot() const
+{
+    return m_impl->snapshot();
+}
+
+unsigned long MapHandle::version() const
+{
+    return m_impl->snapshot()->version();
+}
@@ -0,0 +1,70 @@
+#ifndef MAPHANDLE_INCLUDED
+#define MAPHANDLE_INCLUDED
+
+#include "provided.h"
+#include "StreetGraph.h"
+#include <future>
+#include <memory>
+#include <string>
+
+// MapHandle.h
+
+// A StreetMap that can be replaced while it's in use.  Readers call snapshot() and work
+// against the MapSnapshot they get back for as long as they hold it; a reload builds the
+// new map (graph, indexes and all) on a background thread and then swaps it in with one
+// atomic pointer store.  Requests already running finish on the map they started with,
+// new requests see the new one, and an old snapshot is freed when its last holder lets go.
+
+  // One version of the map, with a router, optimizer and planner bound to it.  All of
+  // them are safe to share between threads.
+class MapSnapshot
+{
+public:
+      // wraps a map owned elsewhere, which must outlive the snapshot
+    MapSnapshot(const StreetMap* sm, unsigned long version);
+    MapSnapshot(std::unique_ptr<StreetMap> sm, unsigned long version);
+    const StreetMap& map() const { return *m_map; }
+      // 0 before anything is loaded, then counts up by one per successful load
+    unsigned long version() const { return m_version; }
+    const PointToPointRouter& router() const { return m_router; }
+    const DeliveryOptimizer& optimizer() const { return m_optimizer; }
+    const DeliveryPlanner& planner() const { return m_planner; }
+
+      // C++11 syntax for preventing copying and assignment
+    MapSnapshot(const MapSnapshot&) = delete;
+    MapSnapshot& operator=(const MapSnapshot&) = delete;
+
+private:
+    std::unique_ptr<StreetMap> m_owned;
+    const StreetMap* m_map;
+    unsigned long m_version;
+    PointToPointRouter m_router;
+    DeliveryOptimizer m_optimizer;
+    DeliveryPlanner m_planner;
+};
+
+class MapHandleImpl;
+
+class MapHandle
+{
+public:
+      // starts out holding an empty map (version 0), on which every lookup is BAD_COORD
+    MapHandle();
+      // waits for any reload still running
+    ~MapHandle();
+      // loads on the calling thread; the current snapshot is untouched if it fails
+    bool load(std::string mapFile, const MapLoadOptions& options = MapLoadOptions());
+      // same, on a background thread; the future says whether the swap happened.  Reloads
+      // are applied in the order they were requested.
+    std::future<bool> reloadAsync(std::string mapFile, const MapLoadOptions& options = MapLoadOptions());
+      // never null; O(1) and lock-free on platforms with lock-free shared_ptr atomics
+    std::shared_ptr<const MapSnapshot> snapshot() const;
+    unsigned long version() const;
+      // We prevent a MapHandle object from being copied or assigned.
+    MapHandle(const MapHandle&) = delete;
+    MapHandle& operator=(const MapHandle&) = delete;
+private:
+    MapHandleImpl* m_impl;
+};
+
+#endif // MAPHANDLE_INCLUDED
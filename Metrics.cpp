@@ -0,0 +1,371 @@
+#include "Metrics.h"
+#include <mutex>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <stdexcept>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+using namespace std;
+
+// Metrics.cpp
+
+//slots per thread; a counter takes one, a histogram one per bucket plus one
+static const int MAX_SLOTS = 1024;
+
+struct Shard {
+    Shard() : inUse(true) {
+        for(int i = 0; i < MAX_SLOTS; i++)
+            slots[i].store(0, memory_order_relaxed);
+    }
+    atomic<unsigned long long> slots[MAX_SLOTS];
+    bool inUse;         // under the registry lock
+};
+
+enum MetricType { COUNTER, GAUGE, HISTOGRAM };
+
+struct Series {
+    string name;
+    string help;
+    string labels;
+    MetricType type;
+    const Counter* counter;
+    const Gauge* gauge;
+    const Histogram* histogram;
+};
+
+//Never destroyed, so metrics and thread exits can use it however late they run.
+struct Registry {
+    mutex lock;
+    vector<Shard*> shards;
+    int slotsUsed = 0;
+    vector<Series> series;
+
+    int reserve(int count){
+        lock_guard<mutex> guard(lock);
+        if(slotsUsed + count > MAX_SLOTS)
+            throw length_error("metrics: more than MAX_SLOTS slots registered");
+        int first = slotsUsed;
+        slotsUsed += count;
+        return first;
+    }
+    void add(const Series& s){
+        lock_guard<mutex> guard(lock);
+        series.push_back(s);
+    }
+    unsigned long long sum(int slot){
+        lock_guard<mutex> guard(lock);
+        unsigned long long total = 0;
+        for(const Shard* s : shards)
+            total += s->slots[slot].load(memory_order_relaxed);
+        return total;
+    }
+};
+
+static Registry& registry(){
+    static Registry* r = new Registry;
+    return *r;
+}
+
+//the calling thread's shard: a plain pointer for the fast path, and an object whose
+//destructor gives the shard back when the thread exits
+static thread_local Shard* t_shard = nullptr;
+
+struct ShardRelease {
+    ~ShardRelease(){
+        if(t_shard == nullptr)
+            return;
+        lock_guard<mutex> guard(registry().lock);
+        t_shard->inUse = false;
+        t_shard = nullptr;
+    }
+};
+static thread_local ShardRelease t_release;
+
+static Shard* acquireShard(){
+    Registry& r = registry();
+    Shard* mine = nullptr;
+    {
+        lock_guard<mutex> guard(r.lock);
+        for(Shard* s : r.shards){
+            if(!s->inUse){
+                s->inUse = true;
+                mine = s;
+                break;
+            }
+        }
+        if(mine == nullptr){
+            mine = new Shard;
+            r.shards.push_back(mine);
+        }
+    }
+    (void)&t_release;   // constructs it, so it runs at this thread's exit
+    t_shard = mine;
+    return mine;
+}
+
+static inline atomic<unsigned long long>* shardSlots(){
+    Shard* s = t_shard;
+    return (s != nullptr ? s : acquireShard())->slots;
+}
+
+//only this thread writes its shard, so there's no need for a read-modify-write
+static inline void bump(atomic<unsigned long long>& slot, unsigned long long n){
+    slot.store(slot.load(memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+static unsigned long long toBits(double d){
+    unsigned long long u;
+    memcpy(&u, &d, sizeof u);
+    return u;
+}
+
+static double fromBits(unsigned long long u){
+    double d;
+    memcpy(&d, &u, sizeof d);
+    return d;
+}
+
+//******************** Counter functions **************************************
+
+Counter::Counter(const string& name, const string& help, const string& labels)
+ : m_slot(registry().reserve(1)){
+    registry().add(Series{ name, help, labels, COUNTER, this, nullptr, nullptr });
+}
+
+void Counter::add(unsigned long long n) const{
+    bump(shardSlots()[m_slot], n);
+}
+
+unsigned long long Counter::value() const{
+    return registry().sum(m_slot);
+}
+
+//******************** Gauge functions ****************************************
+
+Gauge::Gauge(const string& name, const string& help, const string& labels)
+ : m_value(0){
+    registry().add(Series{ name, help, labels, GAUGE, nullptr, this, nullptr });
+}
+
+void Gauge::set(double v){
+    m_value.store(v, memory_order_relaxed);
+}
+
+double Gauge::value() const{
+    return m_value.load(memory_order_relaxed);
+}
+
+//******************** Histogram functions ************************************
+
+Histogram::Histogram(const string& name, const string& help, const vector<double>& bounds, const string& labels)
+ : m_slot(registry().reserve((int)bounds.size() + 2)), m_bounds(bounds){
+    registry().add(Series{ name, help, labels, HISTOGRAM, nullptr, nullptr, this });
+}
+
+void Histogram::observe(double v) const{
+    atomic<unsigned long long>* slots = shardSlots() + m_slot;
+    //a dozen or so bounds, so a linear scan beats a binary search
+    size_t b = 0;
+    while(b < m_bounds.size() && v > m_bounds[b])
+        b++;
+    bump(slots[b], 1);
+    atomic<unsigned long long>& sum = slots[m_bounds.size() + 1];
+    sum.store(toBits(fromBits(sum.load(memory_order_relaxed)) + v), memory_order_relaxed);
+}
+
+HistogramSnapshot Histogram::snapshot() const{
+    HistogramSnapshot h;
+    h.bounds = m_bounds;
+    h.counts.assign(m_bounds.size() + 1, 0);
+    h.count = 0;
+    h.sum = 0;
+    Registry& r = registry();
+    lock_guard<mutex> guard(r.lock);
+    for(const Shard* s : r.shards){
+        for(size_t b = 0; b <= m_bounds.size(); b++)
+            h.counts[b] += s->slots[m_slot + b].load(memory_order_relaxed);
+        h.sum += fromBits(s->slots[m_slot + m_bounds.size() + 1].load(memory_order_relaxed));
+    }
+    for(unsigned long long c : h.counts)
+        h.count += c;
+    return h;
+}
+
+vector<double> Histogram::latencyBuckets(){
+    return vector<double>{ 1e-5, 3e-5, 1e-4, 3e-4, 1e-3, 3e-3, 0.01, 0.03, 0.1, 0.3, 1, 3, 10, 30 };
+}
+
+vector<double> Histogram::ratioBuckets(){
+    return vector<double>{ 0.5, 0.75, 0.9, 1, 1.1, 1.2, 1.3, 1.4, 1.5, 1.75, 2, 2.5, 3 };
+}
+
+//******************** export functions ***************************************
+
+//shortest text that reads back as the same double, and the spellings Prometheus expects
+static string number(double v){
+    if(std::isnan(v))
+        return "NaN";
+    if(std::isinf(v))
+        return v > 0 ? "+Inf" : "-Inf";
+    char buf[32];
+    for(int precision = 6; precision <= 17; precision++){
+        snprintf(buf, sizeof buf, "%.*g", precision, v);
+        if(strtod(buf, nullptr) == v)
+            break;
+    }
+    return buf;
+}
+
+static string braces(const string& labels, const string& extra = ""){
+    if(labels.empty() && extra.empty())
+        return "";
+    if(labels.empty() || extra.empty())
+        return "{" + labels + extra + "}";
+    return "{" + labels + "," + extra + "}";
+}
+
+static void appendSeries(string& out, const Series& s){
+    if(s.type == COUNTER)
+        out += s.name + braces(s.labels) + " " + to_string(s.counter->value()) + "\n";
+    else if(s.type == GAUGE)
+        out += s.name + braces(s.labels) + " " + number(s.gauge->value()) + "\n";
+    else {
+        HistogramSnapshot h = s.histogram->snapshot();
+        unsigned long long cumulative = 0;
+        for(size_t b = 0; b < h.counts.size(); b++){
+            cumulative += h.counts[b];
+            string le = b < h.bounds.size() ? number(h.bounds[b]) : "+Inf";
+            out += s.name + "_bucket" + braces(s.labels, "le=\"" + le + "\"") + " " + to_string(cumulative) + "\n";
+        }
+        out += s.name + "_sum" + braces(s.labels) + " " + number(h.sum) + "\n";
+        out += s.name + "_count" + braces(s.labels) + " " + to_string(h.count) + "\n";
+    }
+}
+
+//each name's HELP and TYPE once, then every series with that name, in the order the names
+//were first registered
+string prometheusText(){
+    vector<Series> all;
+    {
+        Registry& r = registry();
+        lock_guard<mutex> guard(r.lock);
+        all = r.series;
+    }
+    static const char* const typeName[] = { "counter", "gauge", "histogram" };
+    string out;
+    vector<bool> done(all.size(), false);
+    for(size_t i = 0; i < all.size(); i++){
+        if(done[i])
+            continue;
+        out += "# HELP " + all[i].name + " " + all[i].help + "\n";
+        out += "# TYPE " + all[i].name + " " + typeName[all[i].type] + "\n";
+        for(size_t j = i; j < all.size(); j++){
+            if(done[j] || all[j].name != all[i].name)
+                continue;
+            appendSeries(out, all[j]);
+            done[j] = true;
+        }
+    }
+    return out;
+}
+
+bool writeMetricsFile(const string& path){
+    string text = prometheusText();
+    string temp = path + ".tmp";
+    FILE* f = fopen(temp.c_str(), "wb");
+    if(f == nullptr)
+        return false;
+    bool ok = fwrite(text.data(), 1, text.size(), f) == text.size();
+    ok = fclose(f) == 0 && ok;
+    if(!ok || rename(temp.c_str(), path.c_str()) != 0){
+        remove(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+//******************** MetricsServer functions ********************************
+
+#if defined(__unix__) || defined(__APPLE__)
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+//how often the accept loop looks at m_stop, and how long a client gets to send its request
+static const int POLL_MS = 200;
+
+MetricsServer::MetricsServer(const string& socketPath)
+ : m_path(socketPath), m_fd(-1), m_stop(false){
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    if(socketPath.empty() || socketPath.size() >= sizeof addr.sun_path)
+        return;
+    memcpy(addr.sun_path, socketPath.c_str(), socketPath.size());
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0)
+        return;
+    unlink(socketPath.c_str());
+    if(bind(fd, (sockaddr*)&addr, sizeof addr) != 0 || listen(fd, 8) != 0){
+        close(fd);
+        return;
+    }
+    m_fd = fd;
+    m_thread = thread(&MetricsServer::serve, this);
+}
+
+MetricsServer::~MetricsServer(){
+    if(m_fd < 0)
+        return;
+    m_stop.store(true);
+    m_thread.join();
+    close(m_fd);
+    unlink(m_path.c_str());
+}
+
+void MetricsServer::serve(){
+    while(!m_stop.load()){
+        pollfd p = { m_fd, POLLIN, 0 };
+        if(poll(&p, 1, POLL_MS) <= 0)
+            continue;
+        int client = accept(m_fd, nullptr, nullptr);
+        if(client < 0)
+            continue;
+        //whatever request came is read and ignored; every path gets the metrics
+        pollfd c = { client, POLLIN, 0 };
+        char request[1024];
+        if(poll(&c, 1, POLL_MS) > 0)
+            (void)read(client, request, sizeof request);
+        string body = prometheusText();
+        string response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "
+                        + to_string(body.size()) + "\r\n\r\n" + body;
+        size_t sent = 0;
+        while(sent < response.size()){
+            ssize_t n = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+            if(n <= 0)
+                break;
+            sent += n;
+        }
+        close(client);
+    }
+}
+
+#else
+
+MetricsServer::MetricsServer(const string& socketPath)
+ : m_path(socketPath), m_fd(-1), m_stop(false){
+}
+
+MetricsServer::~MetricsServer(){
+}
+
+void MetricsServer::serve(){
+}
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef METRICS_INCLUDED
+#define METRICS_INCLUDED
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+// Metrics.h
+
+// Process-wide counters, gauges and histograms for a long-running planner.  Recording never
+// takes a lock: each thread owns a shard of slots and is the only writer to it, so a record
+// is a relaxed load and store on memory no other thread writes.  Reading merges every shard
+// under the registry's lock, which only readers and a thread's first record take.  A shard
+// left by a thread that exited keeps its counts and is handed to the next new thread.
+//
+// Metrics are defined once, as statics next to the code that records them, and live for the
+// whole process.  Series that share a name (differing only in labels) are exported together.
+// prometheusText() renders all of them in the Prometheus text format; writeMetricsFile()
+// puts that in a file (for node_exporter's textfile collector, or to be read by hand) and a
+// MetricsServer answers every connection to a Unix socket with it:
+//
+//     curl --unix-socket /run/planner.sock http://localhost/metrics
+
+class Counter
+{
+public:
+      // labels are Prometheus label pairs without braces, e.g. result="no_route"
+    Counter(const std::string& name, const std::string& help, const std::string& labels = "");
+    void add(unsigned long long n = 1) const;
+      // summed over every thread
+    unsigned long long value() const;
+
+private:
+    int m_slot;
+};
+
+  // One value for the whole process, last set wins.  Meant for things set rarely, like the
+  // size of the map just loaded, so it's a plain shared atomic rather than per thread.
+class Gauge
+{
+public:
+    Gauge(const std::string& name, const std::string& help, const std::string& labels = "");
+    void set(double v);
+    double value() const;
+
+private:
+    std::atomic<double> m_value;
+};
+
+struct HistogramSnapshot
+{
+    std::vector<double> bounds;                 // bucket upper bounds, ascending
+    std::vector<unsigned long long> counts;     // per bucket, not cumulative; one more than bounds for +Inf
+    unsigned long long count;
+    double sum;
+};
+
+class Histogram
+{
+public:
+      // bounds are the buckets' upper bounds, ascending; values above the last go in +Inf
+    Histogram(const std::string& name, const std::string& help, const std::vector<double>& bounds,
+              const std::string& labels = "");
+    void observe(double v) const;
+    HistogramSnapshot snapshot() const;
+
+      // 10 us to 30 s, two buckets a decade, for latencies in seconds
+    static std::vector<double> latencyBuckets();
+      // 0.5 to 3, for ratios of two distances
+    static std::vector<double> ratioBuckets();
+
+private:
+    int m_slot;                 // counts per bucket, then the sum's bits
+    std::vector<double> m_bounds;
+};
+
+  // Observes the seconds from construction to destruction into a histogram.
+class ScopedTimer
+{
+public:
+    explicit ScopedTimer(const Histogram& h) : m_histogram(h), m_start(std::chrono::steady_clock::now()) {}
+    ~ScopedTimer() { m_histogram.observe(seconds()); }
+    double seconds() const { return std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count(); }
+
+      // C++11 syntax for preventing copying and assignment
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    const Histogram& m_histogram;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+  // every metric in the Prometheus text exposition format, version 0.0.4
+std::string prometheusText();
+  // writes prometheusText() to a temporary file beside path and renames it over path, so a
+  // reader never sees half a dump; false if the file can't be written
+bool writeMetricsFile(const std::string& path);
+
+  // Serves prometheusText() on a Unix domain socket from a thread of its own, as an HTTP/1.0
+  // response so curl and Prometheus (through a socket proxy) can scrape it; anything that just
+  // reads the socket gets the same text after the headers.  Linux and other POSIX systems only.
+class MetricsServer
+{
+public:
+      // replaces a stale socket file at socketPath; listening() is false if it can't bind
+    MetricsServer(const std::string& socketPath);
+      // stops accepting, finishes the connection in progress and removes the socket file
+    ~MetricsServer();
+    bool listening() const { return m_fd >= 0; }
+
+      // C++11 syntax for preventing copying and assignment
+    MetricsServer(const MetricsServer&) = delete;
+    MetricsServer& operator=(const MetricsServer&) = delete;
+
+private:
+    void serve();
+    std::string m_path;
+    int m_fd;
+    std::atomic<bool> m_stop;
+    std::thread m_thread;
+};
+
+#endif // METRICS_INCLUDED
@@ -0,0 +1,67 @@
+#include "PlanningContext.h"
+using namespace std;
+
+// PlanningContext.cpp
+
+PlanningContext::PlanningContext(const StreetGraph& g)
+ : m_graph(g){
+}
+
+const PlanningContext::Leg* PlanningContext::find(NodeId from, NodeId to) const{
+    unordered_map<unsigned long long, Leg>::const_iterator it = m_legs.find(key(from, to));
+    return it == m_legs.end() ? nullptr : &it->second;
+}
+
+bool PlanningContext::findCost(NodeId from, NodeId to, double& cost) const{
+    const Leg* leg = find(from, to);
+    if(leg == nullptr){
+        leg = find(to, from);
+        if(leg != nullptr && leg->directed)
+            leg = nullptr;
+    }
+    if(leg == nullptr)
+        return false;
+    cost = leg->cost;
+    return true;
+}
+
+bool PlanningContext::appendLeg(NodeId from, NodeId to, vector<EdgeId>& route, double& miles) const{
+    const Leg* leg = find(from, to);
+    if(leg != nullptr){
+        route.insert(route.end(), m_edges.begin() + leg->first, m_edges.begin() + leg->first + leg->count);
+        miles = leg->miles;
+        return true;
+    }
+    leg = find(to, from);
+    if(leg == nullptr || leg->directed)
+        return false;
+    //walk the other leg backwards, each edge turned around
+    size_t start = route.size();
+    miles = 0;
+    for(size_t i = leg->count; i > 0; i--){
+        EdgeId e = m_graph.reverseEdge(m_edges[leg->first + i - 1]);
+        if(e == NO_EDGE){
+            route.resize(start);
+            return false;
+        }
+        route.push_back(e);
+        miles += m_graph.edgeLength(e);
+    }
+    return true;
+}
+
+void PlanningContext::addLeg(NodeId from, NodeId to, const EdgePath& path, double miles, double cost, bool directed){
+    Leg leg;
+    leg.first = m_edges.size();
+    leg.count = path.size();
+    leg.miles = miles;
+    leg.cost = cost;
+    leg.directed = directed;
+    if(m_legs.emplace(key(from, to), leg).second)
+        m_edges.insert(m_edges.end(), path.begin(), path.end());
+}
+
+void PlanningContext::clear(){
+    m_legs.clear();
+    m_edges.clear();
+}
@@ -0,0 +1,54 @@
+#ifndef PLANNINGCONTEXT_INCLUDED
+#define PLANNINGCONTEXT_INCLUDED
+
+#include "StreetGraph.h"
+#include <vector>
+#include <unordered_map>
+
+// PlanningContext.h
+
+// Legs routed while one delivery set is planned.  The optimizer prices candidate orders by
+// routing the depot/stop legs they use; keeping every such leg's edge ids here lets the
+// planner build commands straight from them instead of running the same searches again.
+// Every segment exists in both directions, so a leg routed one way also answers for the
+// other, unless it was added as directed: with turn costs a leg's route and cost depend on
+// which way it's driven.  A context is meant for one plan on one thread, over the graph it
+// was made with.
+class PlanningContext
+{
+public:
+    PlanningContext(const StreetGraph& g);
+
+      // cost of the leg routed from -> to, or to -> from if that one isn't directed, in
+      // whatever the optimizer compared
+    bool findCost(NodeId from, NodeId to, double& cost) const;
+      // appends the leg's edges from -> to onto route, reversing an undirected leg routed
+      // the other way if need be; miles is the leg's length
+    bool appendLeg(NodeId from, NodeId to, std::vector<EdgeId>& route, double& miles) const;
+    void addLeg(NodeId from, NodeId to, const EdgePath& path, double miles, double cost, bool directed = false);
+
+    size_t legCount() const { return m_legs.size(); }
+    const StreetGraph& graph() const { return m_graph; }
+    void clear();
+
+      // C++11 syntax for preventing copying and assignment
+    PlanningContext(const PlanningContext&) = delete;
+    PlanningContext& operator=(const PlanningContext&) = delete;
+
+private:
+    struct Leg {
+        size_t first;       // into m_edges
+        size_t count;
+        double miles;
+        double cost;
+        bool directed;      // only answers for the way it was routed
+    };
+    static unsigned long long key(NodeId from, NodeId to){ return ((unsigned long long)from << 32) | to; }
+    const Leg* find(NodeId from, NodeId to) const;
+
+    const StreetGraph& m_graph;
+    std::unordered_map<unsigned long long, Leg> m_legs;
+    std::vector<EdgeId> m_edges;    // every leg's edge ids, back to back
+};
+
+#endif // PLANNINGCONTEXT_INCLUDED
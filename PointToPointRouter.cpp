@@ -1,172 +1,458 @@
 #include "provided.h"
+#include "StreetGraph.h"
+#include "CancellationToken.h"
+#include "RoutingOptions.h"
+#include "SpeedProfile.h"
+#include "Metrics.h"
 #include <list>
-#include <map>
 #include <queue>
-#include <set>
+#include <vector>
+#include <functional>
 #include <algorithm>
+#include <limits>
 using namespace std;
 
-//struct HashF {
-//    unsigned int hash(const GeoCoord& g);
-//    unsigned int h()(const GeoCoord& a){
-//        return hash(a);
-//    }
-//};
-
 class PointToPointRouterImpl
 {
 public:
-    PointToPointRouterImpl(const StreetMap* sm);
+    PointToPointRouterImpl(const StreetMap* sm, const RoutingOptions& options);
     ~PointToPointRouterImpl();
     DeliveryResult generatePointToPointRoute(
         const GeoCoord& start,
         const GeoCoord& end,
         list<StreetSegment>& route,
         double& totalDistanceTravelled) const;
+    DeliveryResult generatePointToPointRoute(
+        const GeoCoord& start,
+        const GeoCoord& end,
+        RouteArena& arena,
+        EdgePath& route,
+        double& totalDistanceTravelled,
+        const CancellationToken* token = nullptr) const;
+    DeliveryResult generateDistancesFrom(
+        const GeoCoord& start,
+        const vector<GeoCoord>& targets,
+        vector<double>& distances,
+        const CancellationToken* token = nullptr) const;
+    DeliveryResult generateDistanceMatrix(
+        const vector<GeoCoord>& sources,
+        const vector<GeoCoord>& targets,
+        vector<vector<double> >& rows,
+        const CancellationToken* token = nullptr,
+        RouteArena* arena = nullptr,
+        vector<vector<EdgePath> >* paths = nullptr) const;
 private:
+    struct SearchLane;
+    void startLane(const StreetGraph& g, SearchLane& lane, int row, NodeId start,
+                   const vector<NodeId>& distinctTargets, bool keepPaths) const;
+    bool expand(const StreetGraph& g, SearchLane& lane, const vector<int>& waiting) const;
     const StreetMap* smap;
-    vector<GeoCoord> reconstructPath(map<GeoCoord, GeoCoord>& cameFrom, GeoCoord current) const;
-    void getStreetSegmentsFromPath(vector<GeoCoord> path, list<StreetSegment>& route) const;
+    RoutingOptions m_options;
+    DeliveryResult findRoute(const GeoCoord& start, const GeoCoord& end, RouteArena& arena, EdgePath& route,
+                             double& totalDistanceTravelled, const CancellationToken* token) const;
+    EdgePath reconstructPath(const vector<EdgeId>& cameFrom, NodeId current, RouteArena& arena) const;
+    DeliveryResult generateTurnAwareRoute(NodeId startNode, NodeId endNode,
+        RouteArena& arena, EdgePath& route, double& totalDistanceTravelled,
+        const CancellationToken* token) const;
+    double turnCost(const StreetGraph& g, EdgeId from, EdgeId to) const;
+      // the metric being minimized: miles, or the weight layer from the options.  g is the
+      // graph the query started with, so a search stays on one NUMA replica.
+    double weight(const StreetGraph& g, EdgeId e, NodeId from, NodeId to) const
+    {
+        return m_options.weights == nullptr ? g.edgeLength(e, from, to) : m_options.weights->weight(e);
+    }
+    double heuristic(const StreetGraph& g, NodeId n, NodeId goal) const
+    {
+        double miles = g.crowDistance(n, goal);
+        return m_options.weights == nullptr ? miles : miles * m_options.weights->minPerMile();
+    }
 };
 
-PointToPointRouterImpl::PointToPointRouterImpl(const StreetMap* sm){
+PointToPointRouterImpl::PointToPointRouterImpl(const StreetMap* sm, const RoutingOptions& options)
+ : m_options(options){
     smap = sm;
 }
 
 PointToPointRouterImpl::~PointToPointRouterImpl(){
 }
 
-
-vector<GeoCoord> PointToPointRouterImpl::reconstructPath(map<GeoCoord, GeoCoord>& cameFrom, GeoCoord current) const{
-    vector<GeoCoord> totalPath;
-    totalPath.push_back(current);
-    while(cameFrom[current] != current){
-        current = cameFrom[current];
-        totalPath.push_back(current);
-    }
-    reverse(totalPath.begin(), totalPath.end());
-    return totalPath;
-}
-
-GeoCoord smallestF(set<GeoCoord>& s, map<GeoCoord, double>& fScore){
-    bool isSet = false;
-    GeoCoord smallest;
-    for(auto i = s.begin(); i != s.end(); i++){
-        if(!isSet || fScore[(*i)] < fScore[smallest]){
-            smallest = (*i);
-            isSet = true;
-        }
-            
-    }
-    return smallest;
+//walks the cameFrom edges back from current, writing them front to back into one arena block
+EdgePath PointToPointRouterImpl::reconstructPath(const vector<EdgeId>& cameFrom, NodeId current, RouteArena& arena) const{
+    const StreetGraph& g = smap->graph();
+    size_t length = 0;
+    for(NodeId n = current; cameFrom[n] != NO_EDGE; n = g.edgeSource(cameFrom[n]))
+        length++;
+    if(length == 0)
+        return EdgePath();
+    EdgeId* edges = arena.allocate(length);
+    size_t i = length;
+    for(NodeId n = current; cameFrom[n] != NO_EDGE; n = g.edgeSource(cameFrom[n]))
+        edges[--i] = cameFrom[n];
+    return EdgePath(edges, length);
 }
 
-double calcDistance(vector<GeoCoord>& path){
-    double distance = 0;
-    for(auto it = path.begin()+1; it != path.end(); it++){
-        distance += distanceEarthMiles(*(it-1), *it);
-    }
-    return distance;
-}
+struct OpenNode {
+    OpenNode(double f, NodeId n) : fScore(f), node(n) {}
+    double fScore;
+    NodeId node;
+    bool operator>(const OpenNode& other) const { return fScore > other.fScore; }
+};
 
-double getGValue(map<GeoCoord, double>& fScore, GeoCoord cur){
-    if(fScore.find(cur) == fScore.end()){
-        //arbitrarily high number, will be replaced by lower g values in A* code
-        fScore[cur] = 999999999;
-        return fScore[cur];
-    }
-    return fScore[cur];
-}
+//one series per DeliveryResult, in enum order
+static const Counter routeResults[] = {
+    Counter("router_routes_total", "Point-to-point route queries by result", "result=\"success\""),
+    Counter("router_routes_total", "Point-to-point route queries by result", "result=\"no_route\""),
+    Counter("router_routes_total", "Point-to-point route queries by result", "result=\"bad_coord\""),
+    Counter("router_routes_total", "Point-to-point route queries by result", "result=\"cancelled\""),
+};
+static const Histogram routeSeconds("router_route_seconds", "Point-to-point route query latency",
+                                    Histogram::latencyBuckets());
+static const Histogram matrixSeconds("router_matrix_seconds", "Distance matrix (and distances-from) latency",
+                                     Histogram::latencyBuckets());
+static const Counter matrixRows("router_matrix_rows_total", "Single-source searches run for distance matrices");
 
-void PointToPointRouterImpl::getStreetSegmentsFromPath(vector<GeoCoord> path, list<StreetSegment>& route) const{
-    list<StreetSegment> tempRoutes;
-    for(int i = 0; i < path.size()-1; i++){
-        vector<StreetSegment> n;
-        smap->getSegmentsThatStartWith(path[i], n);
-        for(int j = 0; j < n.size(); j++){
-            if(n[j].end == path[i+1]){
-                tempRoutes.push_back(StreetSegment(path[i], n[j].end, n[j].name));
-            }
-        }
-    }
-    route = tempRoutes;
+DeliveryResult PointToPointRouterImpl::generatePointToPointRoute(
+        const GeoCoord& start, const GeoCoord& end,
+        RouteArena& arena, EdgePath& route, double& totalDistanceTravelled,
+        const CancellationToken* token) const
+{
+    ScopedTimer timer(routeSeconds);
+    DeliveryResult res = findRoute(start, end, arena, route, totalDistanceTravelled, token);
+    routeResults[res].add();
+    return res;
 }
 
-DeliveryResult PointToPointRouterImpl::generatePointToPointRoute(
+DeliveryResult PointToPointRouterImpl::findRoute(
         const GeoCoord& start, const GeoCoord& end,
-        list<StreetSegment>& route, double& totalDistanceTravelled) const
+        RouteArena& arena, EdgePath& route, double& totalDistanceTravelled,
+        const CancellationToken* token) const
 {
-    vector<StreetSegment> a;
-    if(!smap->getSegmentsThatStartWith(start, a) || !smap->getSegmentsThatStartWith(end, a)){
+    const StreetGraph& g = smap->graph();
+    NodeId startNode, endNode;
+    if(!g.findNode(start, startNode) || !g.findNode(end, endNode)){
         return BAD_COORD;
     }
+    //different components: the search would drain all of start's component before giving up
+    if(!g.connected(startNode, endNode))
+        return NO_ROUTE;
+    if(m_options.useTurnCosts)
+        return generateTurnAwareRoute(startNode, endNode, arena, route, totalDistanceTravelled, token);
 
-    
-    bool routeFound = false;
-    vector<GeoCoord> path;
-    map<GeoCoord, double> fScore;
-    map<GeoCoord, double> gScore;
-    
     //g score is distance from a node to starting node, h is heuristic score (euclidian distance from node to ending node)
-    //f score is f = g + h(n)
-    fScore[start] = distanceEarthMiles(start, end);
-    gScore[start] = 0;
-    
-    set<GeoCoord> openSet;
-    set<GeoCoord> closedSet;
-    openSet.insert(start);
-    
-//    // For node n, cameFrom[n] is the node immediately preceding it on the cheapest path from start
-//    // to n currently known.
-    map<GeoCoord, GeoCoord> cameFrom;
-    cameFrom[start] = start;
+    //f score is f = g + h(n). Scores and the cameFrom edges are indexed by node id, and the
+    //open set is a binary heap that may hold stale entries; those are skipped once the node is closed.
+    vector<double> gScore(g.nodeCount(), numeric_limits<double>::infinity());
+    vector<EdgeId> cameFrom(g.nodeCount(), NO_EDGE);
+    vector<bool> closedSet(g.nodeCount(), false);
+    priority_queue<OpenNode, vector<OpenNode>, greater<OpenNode> > openSet;
+
+    gScore[startNode] = 0;
+    openSet.push(OpenNode(heuristic(g, startNode, endNode), startNode));
 
+    bool routeFound = false;
+    int steps = 0;
     while(!openSet.empty()){
-        GeoCoord current = smallestF(openSet, fScore);
-        //BELOW: USEFUL FOR TESTING
-        //cerr << current.latitudeText << " " << current.longitudeText << " :: " << end.latitudeText << " " << end.longitudeText << endl;
-        if(current == end){
-            path = reconstructPath(cameFrom, current);
+        if(token != nullptr && ++steps % CANCELLATION_CHECK_INTERVAL == 0 && token->isCancelled())
+            return CANCELLED;
+        NodeId current = openSet.top().node;
+        openSet.pop();
+        if(closedSet[current])
+            continue;
+        if(current == endNode){
             routeFound = true;
             break;
         }
+        closedSet[current] = true;
 
-        openSet.erase(current);
-        closedSet.insert(current);
-        
-        vector<StreetSegment> neighbors;
-        smap->getSegmentsThatStartWith(current, neighbors);
-        
-        //checks all of the geoCoord's neighbors, potentially recalculates g and f scores
-        for(auto it = neighbors.begin(); it != neighbors.end(); it++){
-            GeoCoord neighbor = (*it).end;
-            if(closedSet.find(neighbor) != closedSet.end())
+        //checks all of the node's neighbors, potentially recalculates g and f scores. The
+        //neighbours' scores and coordinates are requested first, so their cache misses
+        //overlap instead of coming one after another
+        EdgeId e;
+        NodeId neighbor;
+        for(StreetGraph::EdgeCursor c = g.edgesOf(current); c.next(e, neighbor); ){
+            __builtin_prefetch(&gScore[neighbor]);
+            g.prefetchNode(neighbor);
+        }
+        for(StreetGraph::EdgeCursor c = g.edgesOf(current); c.next(e, neighbor); ){
+            if(closedSet[neighbor])
                 continue;
-            if(openSet.find(neighbor) == openSet.end())
-                openSet.insert(neighbor);
-            
-            double tentative_gScore = getGValue(gScore, current) + distanceEarthMiles(current, neighbor);
-            if(tentative_gScore < getGValue(gScore, neighbor)){
-                cameFrom[neighbor] = current;
+            double tentative_gScore = gScore[current] + weight(g, e, current, neighbor);
+            if(tentative_gScore < gScore[neighbor]){
+                cameFrom[neighbor] = e;
                 gScore[neighbor] = tentative_gScore;
-                fScore[neighbor] = gScore[neighbor] + distanceEarthMiles(neighbor, end);
-//                if(openSet.find(neighbor) == openSet.end())
-//                    openSet.insert(neighbor);
+                openSet.push(OpenNode(tentative_gScore + heuristic(g, neighbor, endNode), neighbor));
             }
         }
+        //most likely the next node expanded
+        if(!openSet.empty())
+            g.prefetchEdges(openSet.top().node);
     }
 
     if(!routeFound)
         return NO_ROUTE;
-       
-    //add up the total distance between all of the geocoordinates in the path
-    totalDistanceTravelled = calcDistance(path);
-    
-    //using path, construct a vector of streetsegments of start GeoCoord to end GeoCoord AND calculate distance from start to end
-    getStreetSegmentsFromPath(path, route);
-    
+
+    route = reconstructPath(cameFrom, endNode, arena);
+    if(m_options.weights == nullptr)
+        totalDistanceTravelled = gScore[endNode];
+    else {
+        //gScore is in the layer's units; the caller still gets miles
+        totalDistanceTravelled = 0;
+        for(EdgeId e : route)
+            totalDistanceTravelled += g.edgeLength(e);
+    }
     return DELIVERY_SUCCESS;
-    
+}
+
+double TurnCosts::between(const StreetGraph& g, EdgeId from, EdgeId to) const{
+    if(g.edgeTarget(to) == g.edgeSource(from))
+        return uTurn;
+    double angle = g.edgeAngle(to) - g.edgeAngle(from);
+    if(angle < 0)
+        angle += 360;
+    if(angle > 170 && angle < 190)
+        return uTurn;
+    //staying on the same street only counts once the bend is a real corner
+    if(g.edgeNameId(to) == g.edgeNameId(from) && (angle <= STREET_BEND || angle >= 360 - STREET_BEND))
+        return 0;
+    if(angle >= 1 && angle < 180)
+        return left;
+    if(angle >= 180 && angle <= 359)
+        return right;
+    return 0;
+}
+
+//penalty for driving straight from edge "from" onto edge "to"
+double PointToPointRouterImpl::turnCost(const StreetGraph& g, EdgeId from, EdgeId to) const{
+    return m_options.turnCosts.between(g, from, to);
+}
+
+//Edge-based A*: a search state is the edge just driven, so the cost of the next step can
+//include the turn from it. Scores, parents and the closed set are indexed by edge id,
+//which keeps the state at about 13 bytes per edge with no hashing. The heuristic is the
+//same crow distance to the goal, still a lower bound since turn penalties are never
+//negative, so the first state popped that ends at the goal is the cheapest.
+DeliveryResult PointToPointRouterImpl::generateTurnAwareRoute(NodeId startNode, NodeId endNode,
+        RouteArena& arena, EdgePath& route, double& totalDistanceTravelled,
+        const CancellationToken* token) const
+{
+    const StreetGraph& g = smap->graph();
+    if(startNode == endNode){
+        totalDistanceTravelled = 0;
+        route = EdgePath();
+        return DELIVERY_SUCCESS;
+    }
+
+    vector<double> gScore(g.edgeCount(), numeric_limits<double>::infinity());
+    vector<EdgeId> cameFrom(g.edgeCount(), NO_EDGE);
+    vector<bool> closedSet(g.edgeCount(), false);
+    priority_queue<OpenNode, vector<OpenNode>, greater<OpenNode> > openSet;
+    EdgeId e;
+    NodeId to;
+    for(StreetGraph::EdgeCursor c = g.edgesOf(startNode); c.next(e, to); ){
+        gScore[e] = weight(g, e, startNode, to);
+        openSet.push(OpenNode(gScore[e] + heuristic(g, to, endNode), e));
+    }
+
+    EdgeId last = NO_EDGE;
+    int steps = 0;
+    while(!openSet.empty()){
+        if(token != nullptr && ++steps % CANCELLATION_CHECK_INTERVAL == 0 && token->isCancelled())
+            return CANCELLED;
+        EdgeId current = openSet.top().node;
+        openSet.pop();
+        if(closedSet[current])
+            continue;
+        NodeId at = g.edgeTarget(current);
+        if(at == endNode){
+            last = current;
+            break;
+        }
+        closedSet[current] = true;
+
+        for(StreetGraph::EdgeCursor c = g.edgesOf(at); c.next(e, to); ){
+            if(closedSet[e])
+                continue;
+            double tentative_gScore = gScore[current] + weight(g, e, at, to) + turnCost(g, current, e);
+            if(tentative_gScore < gScore[e]){
+                cameFrom[e] = current;
+                gScore[e] = tentative_gScore;
+                openSet.push(OpenNode(tentative_gScore + heuristic(g, to, endNode), e));
+            }
+        }
+    }
+    if(last == NO_EDGE)
+        return NO_ROUTE;
+
+    size_t length = 0;
+    for(e = last; e != NO_EDGE; e = cameFrom[e])
+        length++;
+    EdgeId* edges = arena.allocate(length);
+    totalDistanceTravelled = 0;
+    size_t i = length;
+    for(e = last; e != NO_EDGE; e = cameFrom[e]){
+        edges[--i] = e;
+        totalDistanceTravelled += g.edgeLength(e);
+    }
+    route = EdgePath(edges, length);
+    return DELIVERY_SUCCESS;
+}
+
+//One Dijkstra search (no heuristic, since there are many goals) that stops as soon as every
+//target has been settled. Distances are in the options' metric, so minutes with a
+//travel-time layer.
+struct PointToPointRouterImpl::SearchLane {
+    int row;            // index of the source being searched from, -1 when idle
+    int unsettled;      // distinct targets in the source's component not yet settled
+    vector<double> gScore;
+    vector<bool> closedSet;
+    vector<EdgeId> cameFrom;    // empty unless the caller wants the paths
+    priority_queue<OpenNode, vector<OpenNode>, greater<OpenNode> > openSet;
+};
+
+void PointToPointRouterImpl::startLane(const StreetGraph& g, SearchLane& lane, int row, NodeId start,
+                                       const vector<NodeId>& distinctTargets, bool keepPaths) const{
+    lane.row = row;
+    lane.gScore.assign(g.nodeCount(), numeric_limits<double>::infinity());
+    lane.closedSet.assign(g.nodeCount(), false);
+    if(keepPaths)
+        lane.cameFrom.assign(g.nodeCount(), NO_EDGE);
+    lane.openSet = priority_queue<OpenNode, vector<OpenNode>, greater<OpenNode> >();
+    //targets in another component are never waited for; they simply come back unreachable
+    lane.unsettled = 0;
+    for(NodeId t : distinctTargets)
+        if(g.connected(start, t))
+            lane.unsettled++;
+    lane.gScore[start] = 0;
+    lane.openSet.push(OpenNode(0, start));
+}
+
+//settles one node of lane's search; false once the search has nothing left to do
+bool PointToPointRouterImpl::expand(const StreetGraph& g, SearchLane& lane, const vector<int>& waiting) const{
+    while(!lane.openSet.empty() && lane.unsettled > 0){
+        NodeId current = lane.openSet.top().node;
+        lane.openSet.pop();
+        if(lane.closedSet[current])
+            continue;
+        lane.closedSet[current] = true;
+        if(waiting[current] > 0)
+            lane.unsettled--;
+
+        EdgeId e;
+        NodeId neighbor;
+        for(StreetGraph::EdgeCursor c = g.edgesOf(current); c.next(e, neighbor); )
+            __builtin_prefetch(&lane.gScore[neighbor]);
+        for(StreetGraph::EdgeCursor c = g.edgesOf(current); c.next(e, neighbor); ){
+            if(lane.closedSet[neighbor])
+                continue;
+            double tentative_gScore = lane.gScore[current] + weight(g, e, current, neighbor);
+            if(tentative_gScore < lane.gScore[neighbor]){
+                lane.gScore[neighbor] = tentative_gScore;
+                if(!lane.cameFrom.empty())
+                    lane.cameFrom[neighbor] = e;
+                lane.openSet.push(OpenNode(tentative_gScore, neighbor));
+            }
+        }
+        //by the time this lane runs again the next node's edges should be in cache
+        if(!lane.openSet.empty())
+            g.prefetchEdges(lane.openSet.top().node);
+        return true;
+    }
+    return false;
+}
+
+DeliveryResult PointToPointRouterImpl::generateDistancesFrom(
+        const GeoCoord& start, const vector<GeoCoord>& targets, vector<double>& distances,
+        const CancellationToken* token) const
+{
+    vector<vector<double> > rows;
+    DeliveryResult res = generateDistanceMatrix(vector<GeoCoord>(1, start), targets, rows, token);
+    if(res == DELIVERY_SUCCESS)
+        distances.swap(rows[0]);
+    return res;
+}
+
+//up to this many searches take turns on one thread
+static const int SEARCH_LANES = 4;
+
+//A lone search spends most of its time waiting on memory: the next node to expand is only
+//known once the current one is done. Searches from different sources don't depend on each
+//other, so the lanes take turns expanding one node each, and each lane's prefetches have
+//the other lanes' work to hide behind. Every search does exactly what it would alone.
+//With paths, each finished row also walks its searches' parent edges back from every target.
+DeliveryResult PointToPointRouterImpl::generateDistanceMatrix(
+        const vector<GeoCoord>& sources, const vector<GeoCoord>& targets, vector<vector<double> >& rows,
+        const CancellationToken* token, RouteArena* arena, vector<vector<EdgePath> >* paths) const
+{
+    ScopedTimer timer(matrixSeconds);
+    const StreetGraph& g = smap->graph();
+    vector<NodeId> sourceNodes(sources.size());
+    for(size_t i = 0; i < sources.size(); i++){
+        if(!g.findNode(sources[i], sourceNodes[i]))
+            return BAD_COORD;
+    }
+    vector<NodeId> targetNodes(targets.size());
+    for(size_t i = 0; i < targets.size(); i++){
+        if(!g.findNode(targets[i], targetNodes[i]))
+            return BAD_COORD;
+    }
+    vector<int> waiting(g.nodeCount(), 0);
+    vector<NodeId> distinctTargets;
+    for(NodeId t : targetNodes){
+        if(waiting[t]++ == 0)
+            distinctTargets.push_back(t);
+    }
+
+    rows.assign(sources.size(), vector<double>());
+    if(paths != nullptr)
+        paths->assign(sources.size(), vector<EdgePath>(targets.size()));
+    vector<SearchLane> lanes(min((size_t)SEARCH_LANES, sources.size()));
+    size_t nextRow = 0;
+    for(SearchLane& lane : lanes){
+        startLane(g, lane, (int)nextRow, sourceNodes[nextRow], distinctTargets, paths != nullptr);
+        nextRow++;
+    }
+    matrixRows.add(sources.size());
+    size_t active = lanes.size();
+    int steps = 0;
+    while(active > 0){
+        for(SearchLane& lane : lanes){
+            if(lane.row < 0)
+                continue;
+            if(token != nullptr && ++steps % CANCELLATION_CHECK_INTERVAL == 0 && token->isCancelled())
+                return CANCELLED;
+            if(expand(g, lane, waiting))
+                continue;
+            vector<double>& distances = rows[lane.row];
+            distances.resize(targets.size());
+            for(size_t i = 0; i < targetNodes.size(); i++)
+                distances[i] = lane.closedSet[targetNodes[i]] ? lane.gScore[targetNodes[i]] : -1;
+            if(paths != nullptr){
+                for(size_t i = 0; i < targetNodes.size(); i++)
+                    if(lane.closedSet[targetNodes[i]])
+                        (*paths)[lane.row][i] = reconstructPath(lane.cameFrom, targetNodes[i], *arena);
+            }
+            if(nextRow < sources.size()){
+                startLane(g, lane, (int)nextRow, sourceNodes[nextRow], distinctTargets, paths != nullptr);
+                nextRow++;
+            } else {
+                lane.row = -1;
+                active--;
+            }
+        }
+    }
+    return DELIVERY_SUCCESS;
+}
+
+DeliveryResult PointToPointRouterImpl::generatePointToPointRoute(
+        const GeoCoord& start, const GeoCoord& end,
+        list<StreetSegment>& route, double& totalDistanceTravelled) const
+{
+    RouteArena arena;
+    EdgePath path;
+    DeliveryResult res = generatePointToPointRoute(start, end, arena, path, totalDistanceTravelled);
+    if(res == DELIVERY_SUCCESS)
+        smap->graph().materialize(path, route);
+    return res;
 }
     
 
@@ -177,7 +463,12 @@ DeliveryResult PointToPointRouterImpl::generatePointToPointRoute(
 
 PointToPointRouter::PointToPointRouter(const StreetMap* sm)
 {
-    m_impl = new PointToPointRouterImpl(sm);
+    m_impl = new PointToPointRouterImpl(sm, RoutingOptions());
+}
+
+PointToPointRouter::PointToPointRouter(const StreetMap* sm, const RoutingOptions& options)
+{
+    m_impl = new PointToPointRouterImpl(sm, options);
 }
 
 PointToPointRouter::~PointToPointRouter()
@@ -192,6 +483,41 @@ DeliveryResult PointToPointRouter::generatePointToPointRoute(
     return m_impl->generatePointToPointRoute(start, end, route, totalDistanceTravelled);
 }
 
+DeliveryResult PointToPointRouter::generatePointToPointRoute(
+        const GeoCoord& start, const GeoCoord& end,
+        RouteArena& arena, EdgePath& route, double& totalDistanceTravelled) const
+{
+    return m_impl->generatePointToPointRoute(start, end, arena, route, totalDistanceTravelled);
+}
+
+DeliveryResult PointToPointRouter::generatePointToPointRoute(
+        const GeoCoord& start, const GeoCoord& end,
+        RouteArena& arena, EdgePath& route, double& totalDistanceTravelled,
+        const CancellationToken& token) const
+{
+    return m_impl->generatePointToPointRoute(start, end, arena, route, totalDistanceTravelled, &token);
+}
+
+DeliveryResult PointToPointRouter::generateDistancesFrom(
+        const GeoCoord& start, const vector<GeoCoord>& targets, vector<double>& distances) const
+{
+    return m_impl->generateDistancesFrom(start, targets, distances);
+}
+
+DeliveryResult PointToPointRouter::generateDistanceMatrix(
+        const vector<GeoCoord>& sources, const vector<GeoCoord>& targets,
+        vector<vector<double> >& rows) const
+{
+    return m_impl->generateDistanceMatrix(sources, targets, rows);
+}
+
+DeliveryResult PointToPointRouter::generateDistanceMatrix(
+        const vector<GeoCoord>& sources, const vector<GeoCoord>& targets,
+        vector<vector<double> >& rows, RouteArena& arena, vector<vector<EdgePath> >& paths) const
+{
+    return m_impl->generateDistanceMatrix(sources, targets, rows, nullptr, &arena, &paths);
+}
+
 
 
 //int main(){
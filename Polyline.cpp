@@ -0,0 +1,61 @@
+#include "Polyline.h"
+#include <cmath>
+using namespace std;
+
+static void appendValue(string& out, long long delta){
+    unsigned long long v = delta < 0 ? ~((unsigned long long)delta << 1) : (unsigned long long)delta << 1;
+    while(v >= 0x20){
+        out.push_back((char)((0x20 | (v & 0x1f)) + 63));
+        v >>= 5;
+    }
+    out.push_back((char)(v + 63));
+}
+
+void encodePolyline(const StreetGraph& g, const EdgePath& path, string& out, int precision){
+    if(path.empty()) return;
+    double scale = pow(10.0, precision);
+    long long prevLat = 0, prevLon = 0;
+    //the first point is the start of the first edge, every other point the end of an edge,
+    //so the coordinates come straight from the node arrays without building any GeoCoord
+    for(size_t i = 0; i <= path.size(); i++){
+        NodeId n = i == 0 ? g.edgeSource(path[0]) : g.edgeTarget(path[i - 1]);
+        long long lat = llround(g.latitude(n) * scale);
+        long long lon = llround(g.longitude(n) * scale);
+        appendValue(out, lat - prevLat);
+        appendValue(out, lon - prevLon);
+        prevLat = lat;
+        prevLon = lon;
+    }
+}
+
+static bool readValue(const string& s, size_t& pos, long long& value){
+    unsigned long long v = 0;
+    int shift = 0;
+    for(;;){
+        if(pos >= s.size() || shift > 60) return false;
+        int c = s[pos++] - 63;
+        if(c < 0 || c > 63) return false;
+        v |= (unsigned long long)(c & 0x1f) << shift;
+        shift += 5;
+        if(c < 0x20) break;
+    }
+    value = (v & 1) ? ~(long long)(v >> 1) : (long long)(v >> 1);
+    return true;
+}
+
+bool decodePolyline(const string& polyline, vector<double>& lats, vector<double>& lons, int precision){
+    lats.clear();
+    lons.clear();
+    double scale = pow(10.0, precision);
+    long long lat = 0, lon = 0, delta;
+    size_t pos = 0;
+    while(pos < polyline.size()){
+        if(!readValue(polyline, pos, delta)) return false;
+        lat += delta;
+        if(!readValue(polyline, pos, delta)) return false;
+        lon += delta;
+        lats.push_back(lat / scale);
+        lons.push_back(lon / scale);
+    }
+    return true;
+}
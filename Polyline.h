@@ -0,0 +1,23 @@
+#ifndef POLYLINE_INCLUDED
+#define POLYLINE_INCLUDED
+
+#include "StreetGraph.h"
+#include <string>
+
+// Polyline.h
+
+// Google's encoded polyline format: each point is stored as the difference from the
+// previous point, in units of 10^-precision degrees, written as zigzag base-32 varints
+// offset into printable ASCII.  A typical street segment costs 4-8 characters, against
+// the ~40 a pair of text GeoCoords would take, and the result can be handed straight to
+// map UIs that already understand the format.
+
+  // appends the geometry of path (the start of its first edge, then the end of every edge)
+  // to out; an empty path appends nothing
+void encodePolyline(const StreetGraph& g, const EdgePath& path, std::string& out, int precision = 5);
+
+  // decodes a polyline back into latitude/longitude pairs; false if the text is malformed
+bool decodePolyline(const std::string& polyline, std::vector<double>& lats, std::vector<double>& lons,
+                    int precision = 5);
+
+#endif // POLYLINE_INCLUDED
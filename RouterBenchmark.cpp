@@ -0,0 +1,176 @@
+#include "provided.h"
+#include "StreetGraph.h"
+#include "DeliveryIO.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <list>
+#include <random>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+using namespace std;
+
+// RouterBenchmark.cpp
+
+// A fixed, seeded planning workload on a map: map load, point-to-point routes, delivery
+// ordering, full delivery plans, and reading and writing large deliveries files. Prints
+// the wall time of each phase. Run it to compare builds. It is also the training run for
+// profile-guided builds, so it should look like what the planner does in production.
+//
+//     RouterBenchmark [mapdata.txt] [scale] [huge|numa|compressed,...]
+//
+// scale multiplies every phase's query count (default 1). The last argument loads the map
+// with huge pages, per-NUMA-node replicas and/or compressed edges (see MapLoadOptions), to
+// compare against a plain load; run it under "perf stat -e dTLB-load-misses" to see the
+// difference the first two make.
+
+typedef chrono::steady_clock Clock;
+
+static double secondsSince(Clock::time_point start){
+    return chrono::duration<double>(Clock::now() - start).count();
+}
+
+static void report(const string& phase, int count, double seconds){
+    cout.setf(ios::fixed);
+    cout.precision(3);
+    cout << phase << ": " << count << " in " << seconds << " s";
+    cout.precision(1);
+    cout << " (" << seconds * 1e6 / max(count, 1) << " us each)" << endl;
+}
+
+//random nodes from the largest component, so every query has an answer
+static vector<GeoCoord> pickStops(const StreetGraph& g, mt19937& rng, int count){
+    vector<GeoCoord> stops;
+    while((int)stops.size() < count){
+        NodeId n = rng() % g.nodeCount();
+        if(g.componentOf(n) == 0)
+            stops.push_back(g.coord(n));
+    }
+    return stops;
+}
+
+int main(int argc, char *argv[])
+{
+    string mapFile = argc > 1 ? argv[1] : "mapdata.txt";
+    int scale = argc > 2 ? max(1, atoi(argv[2])) : 1;
+    MapLoadOptions options;
+    if(argc > 3){
+        options.hugePages = strstr(argv[3], "huge") != nullptr;
+        options.numaReplicas = strstr(argv[3], "numa") != nullptr;
+        options.compressedEdges = strstr(argv[3], "compressed") != nullptr;
+    }
+
+    Clock::time_point start = Clock::now();
+    StreetMap sm;
+    if(!sm.load(mapFile, options)){
+        cerr << "Unable to load map data file " << mapFile << endl;
+        return 1;
+    }
+    report("load", 1, secondsSince(start));
+    LargePageStats pages = largePageStats();
+    cout << "huge pages: " << pages.explicitHuge / 1024 << " KB explicit, " << pages.transparent / 1024
+         << " KB transparent; " << sm.graph().replicaCount() << " NUMA replicas" << endl;
+    MemoryStats memory = sm.graph().memoryStats();
+    cout << "map memory: " << memory.total() / 1024 << " KB, edges " << memory.edges / 1024 << " KB" << endl;
+    const StreetGraph& g = sm.graph();
+    mt19937 rng(1);
+
+    PointToPointRouter router(&sm);
+    int routes = 500 * scale;
+    vector<GeoCoord> ends = pickStops(g, rng, 2 * routes);
+    RouteArena arena;
+    double checksum = 0;
+    start = Clock::now();
+    for(int i = 0; i < routes; i++){
+        EdgePath path;
+        double miles = 0;
+        arena.reset();
+        router.generatePointToPointRoute(ends[2 * i], ends[2 * i + 1], arena, path, miles);
+        checksum += miles;
+    }
+    report("routes", routes, secondsSince(start));
+
+    //the list overload is what older callers use; it pays for building StreetSegments
+    int listRoutes = 100 * scale;
+    start = Clock::now();
+    for(int i = 0; i < listRoutes; i++){
+        list<StreetSegment> route;
+        double miles = 0;
+        router.generatePointToPointRoute(ends[2 * i], ends[2 * i + 1], route, miles);
+        checksum += miles;
+    }
+    report("segment list routes", listRoutes, secondsSince(start));
+
+    DeliveryOptimizer optimizer(&sm);
+    int tours = 5 * scale;
+    start = Clock::now();
+    for(int t = 0; t < tours; t++){
+        vector<GeoCoord> stops = pickStops(g, rng, 21);
+        vector<DeliveryRequest> deliveries;
+        for(int i = 1; i < (int)stops.size(); i++)
+            deliveries.push_back(DeliveryRequest("item", stops[i]));
+        double oldCrow, newCrow;
+        optimizer.optimizeDeliveryOrder(stops[0], deliveries, oldCrow, newCrow);
+        checksum += newCrow;
+    }
+    report("20-stop orders", tours, secondsSince(start));
+
+    DeliveryPlanner planner(&sm);
+    int plans = 5 * scale;
+    start = Clock::now();
+    for(int p = 0; p < plans; p++){
+        vector<GeoCoord> stops = pickStops(g, rng, 11);
+        vector<DeliveryRequest> deliveries;
+        for(int i = 1; i < (int)stops.size(); i++)
+            deliveries.push_back(DeliveryRequest("item", stops[i]));
+        vector<DeliveryCommand> commands;
+        double miles = 0;
+        planner.generateDeliveryPlan(stops[0], deliveries, commands, miles);
+        checksum += miles;
+    }
+    report("10-stop plans", plans, secondsSince(start));
+
+    //the same rows one search at a time and then interleaved
+    vector<GeoCoord> points = pickStops(g, rng, 40 * scale);
+    vector<vector<double> > rows(points.size());
+    start = Clock::now();
+    for(size_t i = 0; i < points.size(); i++)
+        router.generateDistancesFrom(points[i], points, rows[i]);
+    report("distance rows", (int)points.size(), secondsSince(start));
+    start = Clock::now();
+    router.generateDistanceMatrix(points, points, rows);
+    report("interleaved distance rows", (int)points.size(), secondsSince(start));
+    for(size_t i = 0; i < rows.size(); i++)
+        checksum += rows[i][0];
+
+    //a batch-sized deliveries file, parsed and checked against the map
+    int lines = 100000 * scale;
+    string text;
+    for(const GeoCoord& gc : pickStops(g, rng, lines + 1))
+        text += gc.latitudeText + " " + gc.longitudeText + (text.empty() ? "\n" : ":item\n");
+    start = Clock::now();
+    DeliveryFile df;
+    parseDeliveries(text, df);
+    checksum += df.deliveries.size() - findUnknownStops(g, df).size();
+    report("deliveries file lines", lines, secondsSince(start));
+
+    vector<DeliveryCommand> commands;
+    for(int i = 0; i < lines; i++){
+        DeliveryCommand c;
+        if(i % 2 == 0)
+            c.initAsProceedCommand("northeast", "Westwood Boulevard", i * 0.001);
+        else
+            c.initAsTurnCommand("left", "Westwood Boulevard");
+        commands.push_back(c);
+    }
+    start = Clock::now();
+    string out;
+    writePlan(TEXT_PLAN, commands, 1, out);
+    checksum += out.size();
+    report("plan lines written", lines, secondsSince(start));
+
+    //printed so none of the work can be optimized away
+    cout << "checksum " << checksum << endl;
+    return 0;
+}
@@ -0,0 +1,1361 @@
+#include "provided.h"
+#include "StreetGraph.h"
+#include "RoutingOptions.h"
+#include "SpeedProfile.h"
+#include "Metrics.h"
+#include "CancellationToken.h"
+#include "DeliveryIO.h"
+#include "Polyline.h"
+#include "PlanningContext.h"
+#include "LargePages.h"
+#include "DeliverySession.h"
+#include "AsyncPlanner.h"
+#include "MapHandle.h"
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <queue>
+#include <random>
+#include <limits>
+#include <functional>
+#include <cmath>
+#include <cstdlib>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <algorithm>
+using namespace std;
+
+// RouterRegression.cpp
+
+// Checks every routing mode against a plain reference Dijkstra on seeded random node pairs.
+// For each pair the fast answer must be within tolerance of the reference distance (or agree
+// that there's no route), and the path itself must start at the start, end at the end, have
+// each segment begin where the previous one ended, and add up to the distance reported.
+// Exits with 1 after printing the first failures, each with the pair that caused it.  A map
+// loaded with compressed edges must then match a compact load edge for edge and route for route.
+// Delivery plans must deliver every item along shortest legs, or under a deadline come back
+// CANCELLED, and plans and deliveries files must be written and read exactly as before.
+//
+// The stress phase then routes over the one shared StreetMap from many threads at once,
+// each with its own PointToPointRouter plus a router they all share, and every answer must
+// match the single-threaded reference.  The exported route count must grow by exactly the
+// number of queries made.  Build with SANITIZE=thread to have ThreadSanitizer watch it;
+// pairs = 0 runs only this phase.
+//
+//     RouterRegression [mapdata.txt] [pairs] [seed] [threads]
+//
+// It has its own main(), so build it from every .cpp file except main.cpp.
+
+static const double TOLERANCE = 1e-9;
+static const int MAX_REPORTED = 10;
+
+static int failures = 0;
+
+static void fail(const string& mode, const StreetGraph& g, NodeId a, NodeId b, const string& what){
+    if(++failures > MAX_REPORTED)
+        return;
+    GeoCoord from = g.coord(a), to = g.coord(b);
+    cerr << "FAIL [" << mode << "] " << from.latitudeText << " " << from.longitudeText
+         << " -> " << to.latitudeText << " " << to.longitudeText << ": " << what << endl;
+}
+
+//textbook Dijkstra with no early exit tricks beyond stopping at the goal; slow but obviously right
+static double referenceDistance(const StreetGraph& g, NodeId a, NodeId b, const function<double(EdgeId)>& weight){
+    vector<double> dist(g.nodeCount(), numeric_limits<double>::infinity());
+    priority_queue<pair<double, NodeId>, vector<pair<double, NodeId> >, greater<pair<double, NodeId> > > open;
+    dist[a] = 0;
+    open.push(make_pair(0.0, a));
+    while(!open.empty()){
+        double d = open.top().first;
+        NodeId u = open.top().second;
+        open.pop();
+        if(d > dist[u])
+            continue;
+        if(u == b)
+            return d;
+        for(EdgeId e = g.firstEdge(u); e != g.lastEdge(u); e++){
+            NodeId v = g.edgeTarget(e);
+            if(d + weight(e) < dist[v]){
+                dist[v] = d + weight(e);
+                open.push(make_pair(dist[v], v));
+            }
+        }
+    }
+    return -1;
+}
+
+static bool nearlyEqual(double x, double y){
+    return fabs(x - y) <= TOLERANCE * max(1.0, fabs(y));
+}
+
+//returns the path's cost under weight, or a negative number after reporting why it's invalid
+static double checkPath(const string& mode, const StreetGraph& g, NodeId a, NodeId b, const EdgePath& path,
+                        double reportedMiles, const function<double(EdgeId)>& weight){
+    NodeId at = a;
+    double miles = 0, cost = 0;
+    for(size_t i = 0; i < path.size(); i++){
+        if(g.edgeSource(path[i]) != at){
+            fail(mode, g, a, b, "segment " + to_string(i) + " doesn't start where the previous one ended");
+            return -1;
+        }
+        at = g.edgeTarget(path[i]);
+        miles += g.edgeLength(path[i]);
+        cost += weight(path[i]);
+    }
+    if(at != b){
+        fail(mode, g, a, b, "path doesn't end at the destination");
+        return -1;
+    }
+    if(!nearlyEqual(miles, reportedMiles)){
+        fail(mode, g, a, b, "reported " + to_string(reportedMiles) + " miles but the path is " + to_string(miles));
+        return -1;
+    }
+    return cost;
+}
+
+//reference answers are shared by every mode that minimizes the same weight
+static vector<double> referenceDistances(const StreetGraph& g, const vector<pair<NodeId, NodeId> >& pairs,
+                                         const function<double(EdgeId)>& weight){
+    vector<double> expected(pairs.size());
+    for(size_t i = 0; i < pairs.size(); i++)
+        expected[i] = referenceDistance(g, pairs[i].first, pairs[i].second, weight);
+    return expected;
+}
+
+static void checkRouter(const string& mode, const StreetMap& sm, const PointToPointRouter& router,
+                        const function<double(EdgeId)>& weight, const vector<pair<NodeId, NodeId> >& pairs,
+                        const vector<double>& reference, size_t stride = 1){
+    const StreetGraph& g = sm.graph();
+    RouteArena arena;
+    for(size_t i = 0; i < pairs.size(); i += stride){
+        NodeId a = pairs[i].first, b = pairs[i].second;
+        double expected = reference[i];
+        EdgePath path;
+        double miles = -1;
+        arena.reset();
+        DeliveryResult res = router.generatePointToPointRoute(g.coord(a), g.coord(b), arena, path, miles);
+        if(expected < 0){
+            if(res != NO_ROUTE)
+                fail(mode, g, a, b, "expected NO_ROUTE, got " + to_string(res));
+            continue;
+        }
+        if(res != DELIVERY_SUCCESS){
+            fail(mode, g, a, b, "expected a route, got " + to_string(res));
+            continue;
+        }
+        double cost = checkPath(mode, g, a, b, path, miles, weight);
+        if(cost >= 0 && !nearlyEqual(cost, expected))
+            fail(mode, g, a, b, "cost " + to_string(cost) + ", reference " + to_string(expected));
+    }
+}
+
+//Following one street round a gentle bend must cost nothing with nonzero penalties, while
+//moving onto another street is still charged. A two-segment stretch of one street that bends
+//is then routed with penalties on; it's the shortest way between its ends and has no turn
+//in it, so it has to come back unchanged.
+static void checkTurnPenalties(const StreetMap& sm){
+    const StreetGraph& g = sm.graph();
+    RoutingOptions options;
+    options.useTurnCosts = true;
+    options.turnCosts.left = options.turnCosts.right = 1;
+    options.turnCosts.uTurn = 5;
+    const TurnCosts& costs = options.turnCosts;
+    PointToPointRouter router(&sm, options);
+    function<double(EdgeId)> miles = [&g](EdgeId e){ return g.edgeLength(e); };
+    int bends = 0, routed = 0;
+    RouteArena arena;
+    for(EdgeId e1 = 0; e1 < (EdgeId)g.edgeCount() && failures <= MAX_REPORTED; e1++){
+        NodeId u = g.edgeSource(e1), v = g.edgeTarget(e1);
+        for(EdgeId e2 = g.firstEdge(v); e2 != g.lastEdge(v); e2++){
+            NodeId w = g.edgeTarget(e2);
+            if(w == u)
+                continue;
+            double angle = fmod(g.edgeAngle(e2) - g.edgeAngle(e1) + 360, 360);
+            bool gentle = angle <= TurnCosts::STREET_BEND || angle >= 360 - TurnCosts::STREET_BEND;
+            if(g.edgeNameId(e1) != g.edgeNameId(e2)){
+                if(angle >= 1 && angle <= 359 && costs.between(g, e1, e2) == 0)
+                    fail("turn penalties", g, u, w, "a change of street isn't charged");
+                continue;
+            }
+            if(!gentle || angle < 1 || angle > 359)
+                continue;
+            bends++;
+            if(costs.between(g, e1, e2) != 0)
+                fail("turn penalties", g, u, w, "a bend of " + to_string(angle) + " degrees along one street is charged");
+            //a few of them routed end to end
+            if(routed >= 20 || bends % 50 != 0)
+                continue;
+            double straight = g.edgeLength(e1) + g.edgeLength(e2);
+            if(!nearlyEqual(referenceDistance(g, u, w, miles), straight))
+                continue;
+            routed++;
+            EdgePath path;
+            double d = -1;
+            arena.reset();
+            if(router.generatePointToPointRoute(g.coord(u), g.coord(w), arena, path, d) != DELIVERY_SUCCESS
+               || path.size() != 2 || path[0] != e1 || path[1] != e2)
+                fail("turn penalties", g, u, w, "the straight stretch of one street wasn't taken");
+        }
+    }
+    if(bends == 0 || routed == 0)
+        fail("turn penalties", g, 0, 0, "the map has no bends along one street to check");
+}
+
+//Dijkstra over edges, charging costs.between at every step; the cheapest way to arrive at b
+static double referenceTurnCost(const StreetGraph& g, NodeId a, NodeId b, const function<double(EdgeId)>& weight,
+                                const TurnCosts& costs){
+    if(a == b)
+        return 0;
+    vector<double> dist(g.edgeCount(), numeric_limits<double>::infinity());
+    priority_queue<pair<double, EdgeId>, vector<pair<double, EdgeId> >, greater<pair<double, EdgeId> > > open;
+    for(EdgeId e = g.firstEdge(a); e != g.lastEdge(a); e++){
+        dist[e] = weight(e);
+        open.push(make_pair(dist[e], e));
+    }
+    while(!open.empty()){
+        double d = open.top().first;
+        EdgeId e = open.top().second;
+        open.pop();
+        if(d > dist[e])
+            continue;
+        NodeId at = g.edgeTarget(e);
+        if(at == b)
+            return d;
+        for(EdgeId next = g.firstEdge(at); next != g.lastEdge(at); next++){
+            double nd = d + costs.between(g, e, next) + weight(next);
+            if(nd < dist[next]){
+                dist[next] = nd;
+                open.push(make_pair(nd, next));
+            }
+        }
+    }
+    return -1;
+}
+
+//under a travel-time layer the penalties are minutes: the turn-aware router must find the
+//cheapest time with every turn charged, and the penalties must be big enough to move routes
+static void checkTimedTurnPenalties(const StreetMap& sm, unsigned int seed){
+    const StreetGraph& g = sm.graph();
+    EdgeWeights minutes = EdgeWeights::travelTime(g, SpeedProfile());
+    function<double(EdgeId)> time = [&minutes](EdgeId e){ return minutes.weight(e); };
+    RoutingOptions plain, turning;
+    plain.weights = turning.weights = &minutes;
+    turning.useTurnCosts = true;
+    turning.turnCosts = TurnCosts::travelTime();
+    const TurnCosts& costs = turning.turnCosts;
+    PointToPointRouter plainRouter(&sm, plain), turnRouter(&sm, turning);
+    mt19937 rng(seed + 5);
+    RouteArena arena;
+    int moved = 0, routed = 0;
+    while(routed < 20){
+        NodeId a = (NodeId)(rng() % g.nodeCount()), b = (NodeId)(rng() % g.nodeCount());
+        if(a == b || !g.connected(a, b))
+            continue;
+        routed++;
+        double expected = referenceTurnCost(g, a, b, time, costs);
+        EdgePath path, plainPath;
+        double miles = -1, plainMiles = -1;
+        arena.reset();
+        if(turnRouter.generatePointToPointRoute(g.coord(a), g.coord(b), arena, path, miles) != DELIVERY_SUCCESS
+           || plainRouter.generatePointToPointRoute(g.coord(a), g.coord(b), arena, plainPath, plainMiles) != DELIVERY_SUCCESS){
+            fail("timed turn penalties", g, a, b, "no route between connected nodes");
+            continue;
+        }
+        double cost = 0;
+        for(size_t i = 0; i < path.size(); i++)
+            cost += time(path[i]) + (i > 0 ? costs.between(g, path[i - 1], path[i]) : 0);
+        if(!nearlyEqual(cost, expected))
+            fail("timed turn penalties", g, a, b, "route takes " + to_string(cost) + " minutes with turns, reference "
+                 + to_string(expected));
+        if(path.size() != plainPath.size() || !equal(path.begin(), path.end(), plainPath.begin()))
+            moved++;
+    }
+    if(moved == 0)
+        fail("timed turn penalties", g, 0, 0, "no route of " + to_string(routed) + " changed for its turns");
+}
+
+//the list<StreetSegment> overload: segments must chain by GeoCoord and add up to the distance
+static void checkSegmentList(const StreetMap& sm, const vector<pair<NodeId, NodeId> >& pairs){
+    const StreetGraph& g = sm.graph();
+    PointToPointRouter router(&sm);
+    for(size_t i = 0; i < pairs.size(); i += 10){
+        NodeId a = pairs[i].first, b = pairs[i].second;
+        GeoCoord from = g.coord(a), to = g.coord(b);
+        list<StreetSegment> route;
+        double miles = -1;
+        if(router.generatePointToPointRoute(from, to, route, miles) != DELIVERY_SUCCESS)
+            continue;
+        GeoCoord at = from;
+        double total = 0;
+        bool chained = true;
+        for(list<StreetSegment>::const_iterator it = route.begin(); it != route.end(); it++){
+            if(it->start != at)
+                chained = false;
+            at = it->end;
+            total += distanceEarthMiles(it->start, it->end);
+        }
+        if(!chained || at != to)
+            fail("segment list", g, a, b, "segments don't connect start to end");
+        else if(!nearlyEqual(total, miles))
+            fail("segment list", g, a, b, "segments add up to " + to_string(total) + ", reported " + to_string(miles));
+    }
+}
+
+//one-to-many search against one reference run per target
+static void checkDistancesFrom(const StreetMap& sm, const vector<pair<NodeId, NodeId> >& pairs){
+    const StreetGraph& g = sm.graph();
+    PointToPointRouter router(&sm);
+    function<double(EdgeId)> miles = [&g](EdgeId e){ return g.edgeLength(e); };
+    const size_t targetsPerSource = 8;
+    for(size_t i = 0; i + targetsPerSource <= pairs.size(); i += 25){
+        NodeId a = pairs[i].first;
+        vector<GeoCoord> targets;
+        for(size_t j = 0; j < targetsPerSource; j++)
+            targets.push_back(g.coord(pairs[i + j].second));
+        vector<double> distances;
+        if(router.generateDistancesFrom(g.coord(a), targets, distances) != DELIVERY_SUCCESS){
+            fail("distances from", g, a, pairs[i].second, "search failed");
+            continue;
+        }
+        for(size_t j = 0; j < targetsPerSource; j++){
+            NodeId b = pairs[i + j].second;
+            double expected = referenceDistance(g, a, b, miles);
+            if((expected < 0) != (distances[j] < 0) || (expected >= 0 && !nearlyEqual(distances[j], expected)))
+                fail("distances from", g, a, b, "got " + to_string(distances[j]) + ", reference " + to_string(expected));
+        }
+    }
+}
+
+//a series' value as exported, -1 if it isn't there
+static double exportedValue(const string& series){
+    string text = prometheusText();
+    size_t at = text.find("\n" + series + " ");
+    return at == string::npos ? -1 : atof(text.c_str() + at + series.size() + 2);
+}
+
+//numStops distinct stops and a depot, all in the largest component so every leg has a route
+static vector<DeliveryRequest> randomStops(const StreetGraph& g, int numStops, mt19937& rng, GeoCoord& depot){
+    vector<NodeId> nodes;
+    vector<bool> used(g.nodeCount(), false);
+    while((int)nodes.size() < numStops + 1){
+        NodeId n = (NodeId)(rng() % g.nodeCount());
+        if(g.componentOf(n) != 0 || used[n])
+            continue;
+        used[n] = true;
+        nodes.push_back(n);
+    }
+    depot = g.coord(nodes[0]);
+    vector<DeliveryRequest> stops;
+    for(int i = 1; i <= numStops; i++)
+        stops.push_back(DeliveryRequest("item " + to_string(i), g.coord(nodes[i])));
+    return stops;
+}
+
+//a plan must deliver every item exactly once, and the total it reports must be the length
+//of the shortest route through the stops in the order it delivers them
+static void checkPlan(const string& mode, const StreetGraph& g, const GeoCoord& depot, const vector<DeliveryRequest>& stops,
+                      DeliveryResult res, const vector<DeliveryCommand>& commands, double total){
+    if(res != DELIVERY_SUCCESS){
+        fail(mode, g, 0, 0, "planning returned " + to_string(res));
+        return;
+    }
+    NodeId home;
+    g.findNode(depot, home);
+    vector<pair<string, NodeId> > items;
+    for(size_t i = 0; i < stops.size(); i++){
+        NodeId n;
+        g.findNode(stops[i].location, n);
+        items.push_back(make_pair(stops[i].item, n));
+    }
+    sort(items.begin(), items.end());
+    vector<bool> delivered(items.size(), false);
+    vector<pair<NodeId, NodeId> > legs;
+    NodeId at = home;
+    for(size_t i = 0; i < commands.size(); i++){
+        if(!commands[i].isDeliver())
+            continue;
+        auto it = lower_bound(items.begin(), items.end(), make_pair(commands[i].item(), (NodeId)0));
+        if(it == items.end() || it->first != commands[i].item() || delivered[it - items.begin()]){
+            fail(mode, g, 0, 0, "plan delivers \"" + commands[i].item() + "\", which isn't owed");
+            return;
+        }
+        delivered[it - items.begin()] = true;
+        legs.push_back(make_pair(at, it->second));
+        at = it->second;
+    }
+    legs.push_back(make_pair(at, home));
+    if(legs.size() != items.size() + 1){
+        fail(mode, g, 0, 0, "plan delivers " + to_string(legs.size() - 1) + " of " + to_string(items.size()) + " items");
+        return;
+    }
+    vector<double> shortest = referenceDistances(g, legs, [&g](EdgeId e){ return g.edgeLength(e); });
+    double expected = 0;
+    for(size_t i = 0; i < shortest.size(); i++)
+        expected += shortest[i];
+    if(fabs(total - expected) > 1e-6 * max(1.0, expected))
+        fail(mode, g, 0, 0, "plan reports " + to_string(total) + " miles, its legs add up to " + to_string(expected));
+}
+
+//a deadline cuts the optimizing short and bounds the routing after it; a plan that comes
+//back must still be right. Past 400 stops the clustered mode plans instead of annealing,
+//so it's run both ways.
+static void checkPlans(const StreetMap& sm, unsigned int seed){
+    const StreetGraph& g = sm.graph();
+    mt19937 rng(seed + 2);
+    DeliveryPlanner planner(&sm);
+    const int sizes[] = { 20, 450 };
+    const int timeouts[] = { 0, 50, 200, 60000 };
+    for(int numStops : sizes){
+        GeoCoord depot;
+        vector<DeliveryRequest> stops = randomStops(g, numStops, rng, depot);
+        string mode = "plan, " + to_string(numStops) + " stops";
+        vector<DeliveryCommand> commands;
+        double total = -1;
+        //every leg of the order the optimizer settles on was routed while it searched, and
+        //the clustered mode gets nearly all of them from its matrix searches
+        double routedBefore = exportedValue("planner_legs_total{source=\"routed\"}");
+        double searchesBefore = exportedValue("router_route_seconds_count");
+        DeliveryResult res = planner.generateDeliveryPlan(depot, stops, commands, total);
+        checkPlan(mode, g, depot, stops, res, commands, total);
+        double routed = exportedValue("planner_legs_total{source=\"routed\"}") - routedBefore;
+        double searches = exportedValue("router_route_seconds_count") - searchesBefore;
+        if(routed != 0)
+            fail(mode, g, 0, 0, "the planner routed " + to_string(routed) + " legs the optimizer should have kept");
+        if(numStops > 400 && searches > numStops / 10)
+            fail(mode, g, 0, 0, to_string(searches) + " point-to-point searches for legs the matrices had routed");
+        //a plan cut short either has every leg of its order already routed or gives up
+        for(int ms : timeouts){
+            commands.clear();
+            total = -1;
+            CancellationToken token = CancellationToken::withTimeout(chrono::milliseconds(ms));
+            res = planner.generateDeliveryPlan(depot, stops, commands, total, token);
+            string deadline = mode + ", " + to_string(ms) + " ms deadline";
+            if(res == CANCELLED && !commands.empty())
+                fail(deadline, g, 0, 0, "cancelled plan still has " + to_string(commands.size()) + " commands");
+            else if(res != CANCELLED || ms >= 60000)
+                checkPlan(deadline, g, depot, stops, res, commands, total);
+        }
+    }
+}
+
+//with turn costs a leg costs something else driven the other way, so every leg the optimizer
+//keeps must answer only for its own direction, with what the turn-aware router finds for it
+static void checkTurnLegs(const StreetMap& sm, unsigned int seed){
+    const StreetGraph& g = sm.graph();
+    mt19937 rng(seed + 9);
+    GeoCoord depot;
+    vector<DeliveryRequest> stops = randomStops(g, 12, rng, depot);
+    RoutingOptions options;
+    options.useTurnCosts = true;
+    //a left one way is a right the other, so the two have to cost differently to tell
+    options.turnCosts.left = 1;
+    options.turnCosts.right = 0.1;
+    options.turnCosts.uTurn = 5;
+    DeliveryOptimizer optimizer(&sm, options);
+    PointToPointRouter router(&sm, options);
+    PlanningContext legs(g);
+    double oldCrow, newCrow;
+    vector<DeliveryRequest> order = stops;
+    optimizer.optimizeDeliveryOrder(depot, order, oldCrow, newCrow, legs);
+    vector<GeoCoord> points(1, depot);
+    for(size_t i = 0; i < stops.size(); i++)
+        points.push_back(stops[i].location);
+    RouteArena arena;
+    int checked = 0;
+    for(size_t i = 0; i < points.size(); i++){
+        for(size_t j = 0; j < points.size(); j++){
+            NodeId a, b;
+            double cost;
+            if(i == j || !g.findNode(points[i], a) || !g.findNode(points[j], b) || !legs.findCost(a, b, cost))
+                continue;
+            checked++;
+            EdgePath path;
+            double miles = -1;
+            arena.reset();
+            router.generatePointToPointRoute(points[i], points[j], arena, path, miles);
+            vector<EdgeId> kept;
+            double keptMiles = -1;
+            if(!nearlyEqual(cost, miles))
+                fail("turn-aware legs", g, a, b, "kept cost " + to_string(cost) + ", the router finds " + to_string(miles));
+            else if(!legs.appendLeg(a, b, kept, keptMiles) || kept.size() != path.size() || !equal(kept.begin(), kept.end(), path.begin()))
+                fail("turn-aware legs", g, a, b, "kept leg isn't the route the router finds");
+        }
+    }
+    if(checked < (int)stops.size() + 1)
+        fail("turn-aware legs", g, 0, 0, "only " + to_string(checked) + " legs kept for a tour of " + to_string(stops.size()) + " stops");
+}
+
+//every stop goes to exactly one vehicle, none gets more than its ceil(N/K) share, and each
+//vehicle's loop from the depot back to it must be as long as its shortest legs
+static void checkFleet(const StreetMap& sm, unsigned int seed){
+    const StreetGraph& g = sm.graph();
+    mt19937 rng(seed + 6);
+    GeoCoord depot;
+    vector<DeliveryRequest> stops = randomStops(g, 30, rng, depot);
+    DeliveryPlanner planner(&sm);
+    const int fleets[] = { 1, 4, 7 };
+    for(int k : fleets){
+        string mode = "fleet of " + to_string(k);
+        vector<vector<DeliveryCommand> > commands;
+        vector<double> distances;
+        DeliveryResult res = planner.generateFleetDeliveryPlan(depot, stops, k, commands, distances);
+        if(res != DELIVERY_SUCCESS || (int)commands.size() != k || (int)distances.size() != k){
+            fail(mode, g, 0, 0, "planning returned " + to_string(res) + " for " + to_string(commands.size()) + " vehicles");
+            continue;
+        }
+        size_t share = (stops.size() + k - 1) / k;
+        map<string, int> vehicleOf;
+        for(int v = 0; v < k; v++){
+            vector<DeliveryRequest> own;
+            for(size_t i = 0; i < commands[v].size(); i++){
+                if(!commands[v][i].isDeliver())
+                    continue;
+                const string& item = commands[v][i].item();
+                if(!vehicleOf.insert(make_pair(item, v)).second)
+                    fail(mode, g, 0, 0, item + " is delivered by vehicles " + to_string(vehicleOf[item]) + " and " + to_string(v));
+                for(size_t j = 0; j < stops.size(); j++)
+                    if(stops[j].item == item)
+                        own.push_back(stops[j]);
+            }
+            if(own.size() > share)
+                fail(mode, g, 0, 0, "vehicle " + to_string(v) + " has " + to_string(own.size()) + " stops, over its share of "
+                     + to_string(share));
+            if(own.empty()){
+                if(!commands[v].empty() || distances[v] != 0)
+                    fail(mode, g, 0, 0, "idle vehicle " + to_string(v) + " has commands or miles");
+                continue;
+            }
+            checkPlan(mode + ", vehicle " + to_string(v), g, depot, own, res, commands[v], distances[v]);
+        }
+        if(vehicleOf.size() != stops.size())
+            fail(mode, g, 0, 0, to_string(vehicleOf.size()) + " of " + to_string(stops.size()) + " stops delivered");
+    }
+}
+
+//after every change a session's tour must hold exactly the pending stops, its remaining
+//distance must be the shortest legs from the driver through them back to the depot, and it
+//mustn't be much longer than driving back to the depot and setting out on a fresh order
+static void checkSessionTour(const string& mode, const StreetMap& sm, const DeliverySession& session, const GeoCoord& depot,
+                             NodeId position, const map<int, DeliveryRequest>& pending){
+    const StreetGraph& g = sm.graph();
+    vector<DeliveryRequest> tour;
+    vector<int> ids;
+    session.currentTour(tour, ids);
+    vector<int> sortedIds = ids;
+    sort(sortedIds.begin(), sortedIds.end());
+    vector<int> expectedIds;
+    for(auto it = pending.begin(); it != pending.end(); ++it)
+        expectedIds.push_back(it->first);
+    if(sortedIds != expectedIds){
+        fail(mode, g, 0, 0, "the tour holds " + to_string(ids.size()) + " stops, " + to_string(pending.size()) + " are pending");
+        return;
+    }
+    NodeId home;
+    g.findNode(depot, home);
+    vector<pair<NodeId, NodeId> > legs;
+    NodeId at = position;
+    for(size_t i = 0; i < tour.size(); i++){
+        if(tour[i].item != pending.at(ids[i]).item)
+            fail(mode, g, 0, 0, "stop " + to_string(ids[i]) + " is \"" + tour[i].item + "\" in the tour");
+        NodeId n;
+        g.findNode(tour[i].location, n);
+        legs.push_back(make_pair(at, n));
+        at = n;
+    }
+    legs.push_back(make_pair(at, home));
+    vector<double> shortest = referenceDistances(g, legs, [&g](EdgeId e){ return g.edgeLength(e); });
+    double expected = 0;
+    for(size_t i = 0; i < shortest.size(); i++)
+        expected += shortest[i];
+    double remaining = session.remainingDistance();
+    if(fabs(remaining - expected) > 1e-6 * max(1.0, expected))
+        fail(mode, g, position, home, "session reports " + to_string(remaining) + " miles, its legs add up to " + to_string(expected));
+    if(tour.empty())
+        return;
+    DeliveryOptimizer optimizer(&sm);
+    double oldCrow, newCrow;
+    optimizer.optimizeDeliveryOrder(depot, tour, oldCrow, newCrow);
+    double bound = 1.1 * (newCrow + referenceDistance(g, position, home, [&g](EdgeId e){ return g.edgeLength(e); }));
+    if(remaining > bound + TOLERANCE)
+        fail(mode, g, position, home, "session tour is " + to_string(remaining) + " miles, a fresh order bounds it by "
+             + to_string(bound));
+}
+
+//builds a session stop by stop, cancels and delivers stops in and out of turn (the one being
+//driven to among them), and checks the tour after every step
+static void checkSession(const StreetMap& sm, unsigned int seed){
+    const StreetGraph& g = sm.graph();
+    mt19937 rng(seed + 7);
+    GeoCoord depot;
+    vector<DeliveryRequest> stops = randomStops(g, 16, rng, depot);
+    DeliverySession session(&sm, depot);
+    map<int, DeliveryRequest> pending;
+    NodeId position;
+    g.findNode(depot, position);
+    size_t added = 0;
+    auto add = [&](size_t count){
+        for(; count > 0 && added < stops.size(); count--, added++){
+            int id;
+            if(session.addStop(stops[added], id) != DELIVERY_SUCCESS){
+                fail("session", g, 0, 0, "couldn't add " + stops[added].item);
+                continue;
+            }
+            pending.insert(make_pair(id, stops[added]));
+            checkSessionTour("session, added " + stops[added].item, sm, session, depot, position, pending);
+        }
+    };
+    //the stop at index i of the current tour, 0 being the one the driver is heading for
+    auto tourStop = [&](size_t i){
+        vector<DeliveryRequest> tour;
+        vector<int> ids;
+        session.currentTour(tour, ids);
+        return ids[min(i, ids.size() - 1)];
+    };
+    auto deliver = [&](int id, const string& how){
+        if(!session.markDelivered(id)){
+            fail("session", g, 0, 0, "couldn't deliver pending stop " + to_string(id));
+            return;
+        }
+        g.findNode(pending.at(id).location, position);
+        pending.erase(id);
+        checkSessionTour("session, delivered " + how, sm, session, depot, position, pending);
+    };
+    auto remove = [&](int id, const string& how){
+        if(!session.removeStop(id)){
+            fail("session", g, 0, 0, "couldn't cancel pending stop " + to_string(id));
+            return;
+        }
+        pending.erase(id);
+        checkSessionTour("session, cancelled " + how, sm, session, depot, position, pending);
+    };
+
+    add(10);
+    remove(tourStop(4), "a stop mid-tour");
+    deliver(tourStop(0), "the next stop");
+    remove(tourStop(0), "the stop being driven to");
+    int skipped = tourStop(5);
+    deliver(skipped, "a stop out of turn");
+    if(session.markDelivered(skipped) || session.removeStop(skipped))
+        fail("session", g, 0, 0, "a delivered stop is still pending");
+    add(6);
+    while(!pending.empty())
+        deliver(tourStop(pending.size() / 2), "a stop out of turn");
+}
+
+//an expired deadline is answered without searching, a cancel() stops a request mid-flight,
+//and destroying the planner runs what's still queued so every future it handed out resolves
+static void checkAsyncPlanner(const StreetMap& sm, unsigned int seed){
+    const StreetGraph& g = sm.graph();
+    mt19937 rng(seed + 8);
+    GeoCoord depot;
+    vector<DeliveryRequest> stops = randomStops(g, 20, rng, depot);
+    //the stops furthest apart, so a search between them polls its token many times over
+    size_t from = 0, to = 1;
+    for(size_t i = 0; i < stops.size(); i++)
+        for(size_t j = i + 1; j < stops.size(); j++)
+            if(distanceEarthMiles(stops[i].location, stops[j].location) > distanceEarthMiles(stops[from].location, stops[to].location)){
+                from = i;
+                to = j;
+            }
+
+    {
+        AsyncPlanner planner(&sm, 2);
+        CancellationToken expired = CancellationToken::withTimeout(chrono::milliseconds(0));
+        future<RouteResult> route = planner.generatePointToPointRoute(stops[from].location, stops[to].location, expired);
+        future<OrderResult> order = planner.optimizeDeliveryOrder(depot, stops, expired);
+        future<PlanResult> plan = planner.generateDeliveryPlan(depot, stops, expired);
+        RouteResult r = route.get();
+        if(r.result != CANCELLED || !r.edges.empty())
+            fail("async, expired", g, 0, 0, "route returned " + to_string(r.result) + " with " + to_string(r.edges.size()) + " edges");
+        OrderResult o = order.get();
+        bool same = o.deliveries.size() == stops.size();
+        for(size_t i = 0; same && i < stops.size(); i++)
+            same = o.deliveries[i].item == stops[i].item;
+        if(o.complete || o.newCrowDistance >= 0 || !same)
+            fail("async, expired", g, 0, 0, "ordering ran although its deadline had passed");
+        PlanResult p = plan.get();
+        if(p.result == CANCELLED && !p.commands.empty())
+            fail("async, expired", g, 0, 0, "cancelled plan still has " + to_string(p.commands.size()) + " commands");
+        else if(p.result != CANCELLED)
+            checkPlan("async, expired", g, depot, stops, p.result, p.commands, p.distance);
+    }
+
+    {
+        //one worker, so the second request waits behind the first and is cancelled before it starts
+        AsyncPlanner planner(&sm, 1);
+        vector<DeliveryRequest> many = randomStops(g, 300, rng, depot);
+        CancellationToken token;
+        future<OrderResult> running = planner.optimizeDeliveryOrder(depot, many, token);
+        future<RouteResult> queued = planner.generatePointToPointRoute(stops[from].location, stops[to].location, token);
+        this_thread::sleep_for(chrono::milliseconds(20));
+        chrono::steady_clock::time_point cancelled = chrono::steady_clock::now();
+        token.cancel();
+        OrderResult o = running.get();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - cancelled).count();
+        if(o.complete || seconds > 1)
+            fail("async, cancelled", g, 0, 0, "ordering took " + to_string(seconds) + " s to stop after cancel()");
+        vector<string> before, after;
+        for(size_t i = 0; i < many.size(); i++)
+            before.push_back(many[i].item);
+        for(size_t i = 0; i < o.deliveries.size(); i++)
+            after.push_back(o.deliveries[i].item);
+        sort(before.begin(), before.end());
+        sort(after.begin(), after.end());
+        if(before != after)
+            fail("async, cancelled", g, 0, 0, "cancelled ordering isn't a permutation of the stops");
+        RouteResult r = queued.get();
+        if(r.result != CANCELLED || !r.edges.empty())
+            fail("async, cancelled", g, 0, 0, "queued route returned " + to_string(r.result) + " after cancel()");
+    }
+
+    vector<future<PlanResult> > plans;
+    {
+        AsyncPlanner planner(&sm, 1);
+        for(int i = 0; i < 6; i++)
+            plans.push_back(planner.generateDeliveryPlan(depot, stops));
+    }
+    for(size_t i = 0; i < plans.size(); i++){
+        if(plans[i].wait_for(chrono::seconds(0)) != future_status::ready){
+            fail("async, destroyed", g, 0, 0, "request " + to_string(i) + " was still pending after the planner was destroyed");
+            continue;
+        }
+        PlanResult p = plans[i].get();
+        checkPlan("async, destroyed", g, depot, stops, p.result, p.commands, p.distance);
+    }
+}
+
+//a run the token stops before it has measured an order leaves deliveries as they were and
+//says so with a negative distance; one that measured an order returns a permutation of them
+static void checkCancelledOrder(const StreetMap& sm, unsigned int seed){
+    const StreetGraph& g = sm.graph();
+    mt19937 rng(seed + 4);
+    GeoCoord depot;
+    vector<DeliveryRequest> stops = randomStops(g, 450, rng, depot);
+    DeliveryOptimizer optimizer(&sm);
+    const int timeouts[] = { 0, 20, 100 };
+    for(int ms : timeouts){
+        string mode = "order, 450 stops, " + to_string(ms) + " ms deadline";
+        vector<DeliveryRequest> order = stops;
+        double oldCrow, newCrow;
+        CancellationToken token = CancellationToken::withTimeout(chrono::milliseconds(ms));
+        bool complete = optimizer.optimizeDeliveryOrder(depot, order, oldCrow, newCrow, token);
+        bool same = order.size() == stops.size();
+        for(size_t i = 0; same && i < order.size(); i++)
+            same = order[i].item == stops[i].item;
+        if(newCrow < 0 && !same)
+            fail(mode, g, 0, 0, "deliveries changed although no order was measured");
+        if(complete && newCrow < 0)
+            fail(mode, g, 0, 0, "a complete run reported no distance");
+        if(ms == 0 && (complete || newCrow >= 0))
+            fail(mode, g, 0, 0, "an expired token still produced a measured order");
+        vector<string> before, after;
+        for(size_t i = 0; i < stops.size(); i++)
+            before.push_back(stops[i].item);
+        for(size_t i = 0; i < order.size(); i++)
+            after.push_back(order[i].item);
+        sort(before.begin(), before.end());
+        sort(after.begin(), after.end());
+        if(before != after)
+            fail(mode, g, 0, 0, "deliveries aren't a permutation of the stops");
+    }
+}
+
+//drives order as the vehicle would and says whether every window and the capacity hold
+static bool keepsWindows(const StreetGraph& g, const GeoCoord& depot, const vector<TimedDeliveryRequest>& order,
+                         const VehicleProfile& vehicle){
+    function<double(EdgeId)> miles = [&g](EdgeId e){ return g.edgeLength(e); };
+    NodeId at, next;
+    g.findNode(depot, at);
+    double time = vehicle.departureTime, load = 0;
+    for(size_t i = 0; i <= order.size(); i++){
+        g.findNode(i < order.size() ? order[i].location : depot, next);
+        double d = referenceDistance(g, at, next, miles);
+        if(d < 0)
+            return false;
+        time += d * 60 / vehicle.speedMph;
+        at = next;
+        if(i == order.size())
+            break;
+        time = max(time, order[i].windowOpen);
+        if(time > order[i].windowClose + 1e-6)
+            return false;
+        time += order[i].serviceTime;
+        load += order[i].demand;
+    }
+    return time <= vehicle.returnBy + 1e-6 && load <= vehicle.capacity;
+}
+
+static bool samePermutation(const vector<TimedDeliveryRequest>& a, const vector<TimedDeliveryRequest>& b){
+    vector<string> x, y;
+    for(size_t i = 0; i < a.size(); i++)
+        x.push_back(a[i].item);
+    for(size_t i = 0; i < b.size(); i++)
+        y.push_back(b[i].item);
+    sort(x.begin(), x.end());
+    sort(y.begin(), y.end());
+    return x == y;
+}
+
+//time windows cut from a drive through the stops in a shuffled order must be met; a window
+//closing before the stop can be reached, a load over capacity, or a stop with no route to
+//it must be reported infeasible, with a finite distance
+static void checkTimeWindows(const StreetMap& sm, unsigned int seed){
+    const StreetGraph& g = sm.graph();
+    mt19937 rng(seed + 5);
+    function<double(EdgeId)> miles = [&g](EdgeId e){ return g.edgeLength(e); };
+    GeoCoord depot;
+    vector<DeliveryRequest> stops = randomStops(g, 8, rng, depot);
+    VehicleProfile vehicle;
+    vehicle.departureTime = 8 * 60;
+    vehicle.returnBy = 22 * 60;
+    vector<TimedDeliveryRequest> timed;
+    NodeId at, next;
+    g.findNode(depot, at);
+    double time = vehicle.departureTime;
+    for(size_t i = 0; i < stops.size(); i++){
+        g.findNode(stops[i].location, next);
+        time += referenceDistance(g, at, next, miles) * 60 / vehicle.speedMph;
+        at = next;
+        timed.push_back(TimedDeliveryRequest(stops[i].item, stops[i].location, time - 5, time + 5, 3, 1));
+        time += 3;
+    }
+    shuffle(timed.begin(), timed.end(), rng);
+
+    DeliveryOptimizer optimizer(&sm);
+    vector<TimedDeliveryRequest> order = timed;
+    double oldCrow, newCrow;
+    if(!optimizer.optimizeDeliveryOrder(depot, order, vehicle, oldCrow, newCrow) || !keepsWindows(g, depot, order, vehicle))
+        fail("time windows", g, 0, 0, "a feasible set of windows wasn't met");
+    if(!samePermutation(order, timed))
+        fail("time windows", g, 0, 0, "feasible order isn't a permutation of the stops");
+
+    //the first stop has to be served within a minute of leaving, which no leg allows
+    vector<TimedDeliveryRequest> late = timed;
+    late[0].windowOpen = vehicle.departureTime;
+    late[0].windowClose = vehicle.departureTime + 1.0 / 60;
+    order = late;
+    if(optimizer.optimizeDeliveryOrder(depot, order, vehicle, oldCrow, newCrow) || std::isnan(newCrow))
+        fail("time windows", g, 0, 0, "an unreachable window was reported as met");
+    if(!samePermutation(order, late))
+        fail("time windows", g, 0, 0, "late order isn't a permutation of the stops");
+
+    VehicleProfile small = vehicle;
+    small.capacity = (double)timed.size() - 1;
+    order = timed;
+    if(optimizer.optimizeDeliveryOrder(depot, order, small, oldCrow, newCrow) || std::isnan(newCrow))
+        fail("time windows", g, 0, 0, "a load over capacity was reported as feasible");
+
+    NodeId stranded = 0;
+    while(stranded < (NodeId)g.nodeCount() && g.componentOf(stranded) == 0)
+        stranded++;
+    if(stranded < (NodeId)g.nodeCount()){
+        order = timed;
+        order.push_back(TimedDeliveryRequest("stranded", g.coord(stranded), 0, 24 * 60));
+        if(optimizer.optimizeDeliveryOrder(depot, order, vehicle, oldCrow, newCrow) || !std::isfinite(newCrow))
+            fail("time windows", g, 0, 0, "a stop with no route to it was reported as feasible, or left "
+                 + to_string(newCrow) + " miles");
+    }
+}
+
+//the text plan must be byte for byte what printing each description() used to give, the
+//other formats must escape what they have to, and a deliveries file's bad lines must be
+//skipped with their reasons while the good ones keep their line numbers
+static void checkDeliveryIO(const StreetMap& sm, unsigned int seed){
+    const StreetGraph& g = sm.graph();
+    mt19937 rng(seed + 3);
+    GeoCoord depot;
+    vector<DeliveryRequest> stops = randomStops(g, 5, rng, depot);
+    DeliveryPlanner planner(&sm);
+    vector<DeliveryCommand> commands;
+    double total;
+    if(planner.generateDeliveryPlan(depot, stops, commands, total) != DELIVERY_SUCCESS)
+        fail("delivery io", g, 0, 0, "couldn't plan the stops to write");
+    DeliveryCommand odd;
+    odd.initAsProceedCommand("north", "Rounding Way", 0.005);
+    commands.push_back(odd);
+    odd.initAsProceedCommand("south", "Long Road", 12345.675);
+    commands.push_back(odd);
+    commands.push_back(DeliveryCommand());
+
+    ostringstream oss;
+    oss << "Starting at the depot...\n";
+    for(size_t i = 0; i < commands.size(); i++)
+        oss << commands[i].description() << endl;
+    oss << "You are back at the depot and your deliveries are done!\n";
+    oss.setf(ios::fixed);
+    oss.precision(2);
+    oss << total << " miles travelled for all deliveries." << endl;
+    string text;
+    writePlan(TEXT_PLAN, commands, total, text);
+    if(text != oss.str())
+        fail("delivery io", g, 0, 0, "text plan differs from the descriptions:\n" + text);
+
+    vector<DeliveryCommand> awkward(3);
+    awkward[0].initAsProceedCommand("east", "Main \"St\", A\\B", 1.5);
+    awkward[1].initAsTurnCommand("left", "Plain St");
+    awkward[2].initAsDeliverCommand("Tacos\nand\x01 salsa, \"hot\"");
+    string json, csv;
+    writePlan(JSON_PLAN, awkward, 1.5, json);
+    writePlan(CSV_PLAN, awkward, 1.5, csv);
+    string expectedJson = "{\"commands\":["
+        "{\"type\":\"proceed\",\"direction\":\"east\",\"street\":\"Main \\\"St\\\", A\\\\B\",\"miles\":1.5},"
+        "{\"type\":\"turn\",\"direction\":\"left\",\"street\":\"Plain St\"},"
+        "{\"type\":\"deliver\",\"item\":\"Tacos\\u000aand\\u0001 salsa, \\\"hot\\\"\"}"
+        "],\"totalMiles\":1.5}\n";
+    string expectedCsv = "type,direction,street,miles,item\n"
+        "proceed,east,\"Main \"\"St\"\", A\\B\",1.5,\n"
+        "turn,left,Plain St,,\n"
+        "deliver,,,,\"Tacos\nand\x01 salsa, \"\"hot\"\"\"\n"
+        "total,,,1.5,\n";
+    if(json != expectedJson)
+        fail("delivery io", g, 0, 0, "JSON plan is\n" + json);
+    if(csv != expectedCsv)
+        fail("delivery io", g, 0, 0, "CSV plan is\n" + csv);
+
+    string file = "34.0625329 -118.4470263\n"
+                  "34.0712323 -118.4505969:Chicken tenders\n"
+                  "no colon here\n"
+                  "34.0712323:Bad\n"
+                  "34.0666168 -118.4395786:\n"
+                  "north west:Nowhere\n"
+                  "34.0666168 -118.4395786:Pizza\n";
+    DeliveryFile df;
+    if(!parseDeliveries(file, df) || df.depot.latitudeText != "34.0625329" || df.depot.longitudeText != "-118.4470263")
+        fail("delivery io", g, 0, 0, "deliveries file depot not read");
+    if(df.deliveries.size() != 2 || df.lineOf != vector<int>{ 2, 7 }
+       || df.deliveries[0].item != "Chicken tenders" || df.deliveries[1].item != "Pizza"
+       || df.deliveries[1].location.latitudeText != "34.0666168")
+        fail("delivery io", g, 0, 0, "deliveries file read " + to_string(df.deliveries.size()) + " stops, not lines 2 and 7");
+    string expectedProblems = "Missing colon in deliveries file line: no colon here\n"
+                              "Bad format in deliveries file line: 34.0712323:Bad\n"
+                              "Missing item in deliveries file line: 34.0666168 -118.4395786:\n"
+                              "Bad format in deliveries file line: north west:Nowhere\n";
+    if(df.problems != expectedProblems)
+        fail("delivery io", g, 0, 0, "deliveries file problems are\n" + df.problems);
+}
+
+//Google's worked example from the format's documentation, encoded from a two-segment map
+//of its three points and decoded back
+static void checkPolyline(const StreetGraph& mainGraph){
+    const string lats[] = { "38.5", "40.7", "43.252" }, lons[] = { "-120.2", "-120.95", "-126.453" };
+    const string reference = "_p~iF~ps|U_ulLnnqC_mqNvxq`@";
+    string mapFile = (filesystem::temp_directory_path() / ("polyline_" + to_string(chrono::steady_clock::now().time_since_epoch().count()) + ".txt")).string();
+    {
+        ofstream out(mapFile);
+        out << "Reference Way\n2\n";
+        for(int i = 0; i < 2; i++)
+            out << lats[i] << " " << lons[i] << " " << lats[i + 1] << " " << lons[i + 1] << "\n";
+    }
+    StreetMap sm;
+    bool loaded = sm.load(mapFile);
+    filesystem::remove(mapFile);
+    if(!loaded){
+        fail("polyline", mainGraph, 0, 0, "reference map didn't load");
+        return;
+    }
+    const StreetGraph& g = sm.graph();
+    NodeId nodes[3];
+    for(int i = 0; i < 3; i++){
+        if(!g.findNode(GeoCoord(lats[i], lons[i]), nodes[i])){
+            fail("polyline", mainGraph, 0, 0, "reference map is missing " + lats[i] + " " + lons[i]);
+            return;
+        }
+    }
+    vector<EdgeId> edges;
+    for(int i = 0; i < 2; i++)
+        for(EdgeId e = g.firstEdge(nodes[i]); e != g.lastEdge(nodes[i]); e++)
+            if(g.edgeTarget(e) == nodes[i + 1])
+                edges.push_back(e);
+    if(edges.size() != 2){
+        fail("polyline", g, nodes[0], nodes[2], "reference map doesn't join its three points");
+        return;
+    }
+    string encoded;
+    encodePolyline(g, EdgePath(edges.data(), edges.size()), encoded);
+    if(encoded != reference)
+        fail("polyline", g, nodes[0], nodes[2], "encoded as " + encoded + ", not " + reference);
+    vector<double> decodedLats, decodedLons;
+    if(!decodePolyline(reference, decodedLats, decodedLons) || decodedLats.size() != 3 || decodedLons.size() != 3){
+        fail("polyline", g, nodes[0], nodes[2], "couldn't decode " + reference);
+        return;
+    }
+    for(int i = 0; i < 3; i++)
+        if(!nearlyEqual(decodedLats[i], atof(lats[i].c_str())) || !nearlyEqual(decodedLons[i], atof(lons[i].c_str())))
+            fail("polyline", g, nodes[i], nodes[i], "decoded as " + to_string(decodedLats[i]) + " " + to_string(decodedLons[i]));
+}
+
+//threads record their failures and the main thread reports them after joining, so the
+//checker itself doesn't add shared state for the sanitizer to trip over
+static void stressTest(const StreetMap& sm, int numThreads, unsigned int seed){
+    const StreetGraph& g = sm.graph();
+    const int numPairs = 256;
+    const int queriesPerThread = 32;
+    mt19937 rng(seed + 1);
+    vector<pair<NodeId, NodeId> > pairs;
+    for(int i = 0; i < numPairs; i++)
+        pairs.push_back(make_pair((NodeId)(rng() % g.nodeCount()), (NodeId)(rng() % g.nodeCount())));
+    function<double(EdgeId)> miles = [&g](EdgeId e){ return g.edgeLength(e); };
+    vector<double> expected = referenceDistances(g, pairs, miles);
+
+    PointToPointRouter shared(&sm);
+    double routesBefore = exportedValue("router_route_seconds_count");
+    atomic<bool> go(false);
+    vector<vector<size_t> > wrong(numThreads);
+    vector<thread> workers;
+    for(int t = 0; t < numThreads; t++){
+        workers.push_back(thread([&, t]{
+            PointToPointRouter own(&sm);
+            RouteArena arena;
+            vector<StreetSegment> segs;
+            while(!go)
+                this_thread::yield();
+            //each thread starts at a different pair so they hit different parts of the map
+            for(int q = 0; q < queriesPerThread; q++){
+                size_t i = (t * 7 + q) % pairs.size();
+                const PointToPointRouter& router = q % 2 == 0 ? own : shared;
+                GeoCoord from = g.coord(pairs[i].first), to = g.coord(pairs[i].second);
+                EdgePath path;
+                double d = -1;
+                arena.reset();
+                DeliveryResult res = router.generatePointToPointRoute(from, to, arena, path, d);
+                bool ok = expected[i] < 0 ? res == NO_ROUTE : res == DELIVERY_SUCCESS && nearlyEqual(d, expected[i]);
+                if(!sm.getSegmentsThatStartWith(from, segs) || segs.size() != g.lastEdge(pairs[i].first) - g.firstEdge(pairs[i].first))
+                    ok = false;
+                if(!ok)
+                    wrong[t].push_back(i);
+            }
+        }));
+    }
+    go = true;
+    for(size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
+
+    for(int t = 0; t < numThreads; t++){
+        for(size_t k = 0; k < wrong[t].size(); k++){
+            size_t i = wrong[t][k];
+            fail("stress, thread " + to_string(t), g, pairs[i].first, pairs[i].second,
+                 "answer differs from the single-threaded reference");
+        }
+    }
+    //every thread's shard is merged on read, including those of threads that have exited
+    double routes = exportedValue("router_route_seconds_count") - routesBefore;
+    if(routes != (double)numThreads * queriesPerThread)
+        fail("stress metrics", g, 0, 0, "router_route_seconds_count grew by " + to_string(routes) + ", not "
+             + to_string(numThreads * queriesPerThread));
+}
+
+static void regressionTest(const StreetMap& sm, int numPairs, unsigned int seed){
+    const StreetGraph& g = sm.graph();
+    mt19937 rng(seed);
+    vector<pair<NodeId, NodeId> > pairs;
+    for(int i = 0; i < numPairs; i++)
+        pairs.push_back(make_pair((NodeId)(rng() % g.nodeCount()), (NodeId)(rng() % g.nodeCount())));
+    //a few fixed edge cases: start == end, and two nodes one segment apart
+    pairs.push_back(make_pair(pairs[0].first, pairs[0].first));
+    pairs.push_back(make_pair(g.edgeSource(0), g.edgeTarget(0)));
+
+    function<double(EdgeId)> miles = [&g](EdgeId e){ return g.edgeLength(e); };
+
+    vector<double> shortest = referenceDistances(g, pairs, miles);
+
+    PointToPointRouter astar(&sm);
+    checkRouter("A*", sm, astar, miles, pairs, shortest);
+
+    //with every penalty at zero the edge-based search must find the same shortest distances.
+    //It's several times slower than node A*, so it gets every fourth pair.
+    RoutingOptions freeTurns;
+    freeTurns.useTurnCosts = true;
+    freeTurns.turnCosts.left = freeTurns.turnCosts.right = freeTurns.turnCosts.uTurn = 0;
+    PointToPointRouter turnAware(&sm, freeTurns);
+    checkRouter("turn-aware", sm, turnAware, miles, pairs, shortest, 4);
+    checkTurnPenalties(sm);
+    checkTimedTurnPenalties(sm, seed);
+
+    EdgeWeights minutes = EdgeWeights::travelTime(g, SpeedProfile());
+    RoutingOptions byTime;
+    byTime.weights = &minutes;
+    PointToPointRouter timed(&sm, byTime);
+    function<double(EdgeId)> time = [&minutes](EdgeId e){ return minutes.weight(e); };
+    checkRouter("travel time", sm, timed, time, pairs, referenceDistances(g, pairs, time));
+
+    checkSegmentList(sm, pairs);
+    checkDistancesFrom(sm, pairs);
+    checkPlans(sm, seed);
+    checkTurnLegs(sm, seed);
+    checkCancelledOrder(sm, seed);
+    checkFleet(sm, seed);
+    checkSession(sm, seed);
+    checkAsyncPlanner(sm, seed);
+    checkTimeWindows(sm, seed);
+    checkDeliveryIO(sm, seed);
+    checkPolyline(sm.graph());
+
+    //coordinates that aren't on the map
+    RouteArena arena;
+    EdgePath path;
+    double d;
+    if(astar.generatePointToPointRoute(GeoCoord("0.0000001", "0.0000001"), g.coord(0), arena, path, d) != BAD_COORD)
+        fail("A*", g, 0, 0, "unknown start coordinate should be BAD_COORD");
+}
+
+//every node order must give the same shortest distances between the same places as the
+//file's own numbering, both by reference Dijkstra over its arrays and by the router
+static void checkNodeOrders(const string& mapFile, int numPairs, unsigned int seed){
+    MapLoadOptions inFileOrder;
+    inFileOrder.nodeOrder = FILE_ORDER;
+    StreetMap fileMap;
+    if(!fileMap.load(mapFile, inFileOrder)){
+        fail("node order", fileMap.graph(), 0, 0, "map didn't load in file order");
+        return;
+    }
+    const StreetGraph& fg = fileMap.graph();
+    mt19937 rng(seed + 3);
+    vector<pair<NodeId, NodeId> > filePairs;
+    for(int i = 0; i < numPairs; i++)
+        filePairs.push_back(make_pair((NodeId)(rng() % fg.nodeCount()), (NodeId)(rng() % fg.nodeCount())));
+    vector<double> expected = referenceDistances(fg, filePairs, [&fg](EdgeId e){ return fg.edgeLength(e); });
+
+    const NodeOrder orders[] = { FILE_ORDER, HILBERT_ORDER, BFS_ORDER };
+    const string names[] = { "file", "Hilbert", "RCM" };
+    for(int o = 0; o < 3; o++){
+        string mode = "A*, " + names[o] + " order";
+        MapLoadOptions options;
+        options.nodeOrder = orders[o];
+        StreetMap sm;
+        if(!sm.load(mapFile, options)){
+            fail(mode, fg, 0, 0, "map didn't load");
+            continue;
+        }
+        const StreetGraph& g = sm.graph();
+        if(g.nodeCount() != fg.nodeCount() || g.edgeCount() != fg.edgeCount()){
+            fail(mode, fg, 0, 0, "graph shape differs from the file order's");
+            continue;
+        }
+        vector<pair<NodeId, NodeId> > pairs;
+        for(size_t i = 0; i < filePairs.size(); i++){
+            NodeId a = 0, b = 0;
+            if(!g.findNode(fg.coord(filePairs[i].first), a) || !g.findNode(fg.coord(filePairs[i].second), b))
+                fail(mode, fg, filePairs[i].first, filePairs[i].second, "a node of the file order is missing");
+            pairs.push_back(make_pair(a, b));
+        }
+        function<double(EdgeId)> miles = [&g](EdgeId e){ return g.edgeLength(e); };
+        vector<double> reference = referenceDistances(g, pairs, miles);
+        for(size_t i = 0; i < pairs.size(); i++)
+            if(!nearlyEqual(reference[i], expected[i]))
+                fail(mode, g, pairs[i].first, pairs[i].second, "reference distance " + to_string(reference[i])
+                     + ", in file order " + to_string(expected[i]));
+        PointToPointRouter router(&sm);
+        checkRouter(mode, sm, router, miles, pairs, expected);
+    }
+}
+
+//a map on huge pages with a copy per NUMA node routes like any other, and gives back every
+//mapped byte when it goes; so does a block freed under a policy it wasn't allocated with
+static void checkLargePages(const StreetGraph& mainGraph, const string& mapFile, int numPairs, unsigned int seed){
+    LargePageStats before = largePageStats();
+    {
+        MapLoadOptions options;
+        options.hugePages = true;
+        options.numaReplicas = true;
+        StreetMap sm;
+        if(!sm.load(mapFile, options)){
+            fail("large pages", mainGraph, 0, 0, "map didn't load");
+            return;
+        }
+        const StreetGraph& g = sm.graph();
+        mt19937 rng(seed + 4);
+        vector<pair<NodeId, NodeId> > pairs;
+        for(int i = 0; i < numPairs; i++)
+            pairs.push_back(make_pair((NodeId)(rng() % g.nodeCount()), (NodeId)(rng() % g.nodeCount())));
+        function<double(EdgeId)> miles = [&g](EdgeId e){ return g.edgeLength(e); };
+        PointToPointRouter router(&sm);
+        checkRouter("A*, large pages", sm, router, miles, pairs, referenceDistances(g, pairs, miles));
+    }
+    LargePagePolicy huge;
+    huge.hugePages = true;
+    const size_t bytes = 4 * 1024 * 1024;
+    freeLarge(allocateLarge(bytes, huge), bytes, LargePagePolicy());
+    freeLarge(allocateLarge(64, LargePagePolicy()), 64, huge);
+    LargePageStats after = largePageStats();
+    if(after.explicitHuge != before.explicitHuge || after.transparent != before.transparent || after.nodeBound != before.nodeBound)
+        fail("large pages", mainGraph, 0, 0, to_string(after.explicitHuge + after.transparent - before.explicitHuge
+             - before.transparent) + " bytes still mapped after every block was freed");
+}
+
+//a compressed load must answer every edge query exactly as a compact one does, and route the same
+static void checkCompressed(const string& mapFile, int numPairs, unsigned int seed){
+    MapLoadOptions compact, compressed;
+    compact.compactStorage = true;
+    compressed.compressedEdges = true;
+    StreetMap plainMap, packedMap;
+    if(!plainMap.load(mapFile, compact) || !packedMap.load(mapFile, compressed)){
+        fail("compressed", plainMap.graph(), 0, 0, "map didn't load");
+        return;
+    }
+    const StreetGraph& plain = plainMap.graph();
+    const StreetGraph& packed = packedMap.graph();
+    if(!packed.compressedEdges() || packed.nodeCount() != plain.nodeCount() || packed.edgeCount() != plain.edgeCount()){
+        fail("compressed", plain, 0, 0, "graph shape differs from the compact load");
+        return;
+    }
+    for(NodeId n = 0; n < (NodeId)packed.nodeCount(); n++){
+        EdgeId e;
+        NodeId to;
+        for(StreetGraph::EdgeCursor c = packed.edgesOf(n); c.next(e, to); ){
+            if(packed.edgeSource(e) != n || packed.edgeTarget(e) != to || to != plain.edgeTarget(e)
+               || packed.edgeLength(e) != plain.edgeLength(e) || packed.edgeAngle(e) != plain.edgeAngle(e)
+               || packed.edgeNameId(e) != plain.edgeNameId(e) || packed.reverseEdge(e) != plain.reverseEdge(e))
+                fail("compressed", plain, n, to, "edge " + to_string(e) + " differs from the compact load");
+        }
+    }
+
+    mt19937 rng(seed);
+    PointToPointRouter plainRouter(&plainMap), packedRouter(&packedMap);
+    RouteArena arena;
+    for(int i = 0; i < numPairs; i++){
+        NodeId a = (NodeId)(rng() % plain.nodeCount()), b = (NodeId)(rng() % plain.nodeCount());
+        EdgePath plainPath, packedPath;
+        double plainMiles = 0, packedMiles = 0;
+        DeliveryResult r1 = plainRouter.generatePointToPointRoute(plain.coord(a), plain.coord(b), arena, plainPath, plainMiles);
+        DeliveryResult r2 = packedRouter.generatePointToPointRoute(packed.coord(a), packed.coord(b), arena, packedPath, packedMiles);
+        if(r1 != r2 || plainMiles != packedMiles || !equal(plainPath.begin(), plainPath.end(), packedPath.begin(), packedPath.end()))
+            fail("compressed", plain, a, b, "route differs from the compact load");
+    }
+}
+
+//readers keep routing on snapshots while the map is reloaded twice in a row and then fails a
+//third time. The first reload is a one-way map and the second the full one again, so the
+//map left published says whether the reloads ran in the order they were asked for.
+static void checkReload(const StreetMap& sm, const string& mapFile, int numThreads, unsigned int seed){
+    const StreetGraph& g = sm.graph();
+    const int numPairs = 64;
+    mt19937 rng(seed + 2);
+    vector<pair<NodeId, NodeId> > pairs;
+    for(int i = 0; i < numPairs; i++)
+        pairs.push_back(make_pair((NodeId)(rng() % g.nodeCount()), (NodeId)(rng() % g.nodeCount())));
+    vector<double> expected = referenceDistances(g, pairs, [&g](EdgeId e){ return g.edgeLength(e); });
+
+    string ticks = to_string(chrono::steady_clock::now().time_since_epoch().count());
+    string smallFile = (filesystem::temp_directory_path() / ("reload_" + ticks + ".txt")).string();
+    string missingFile = (filesystem::temp_directory_path() / ("reload_missing_" + ticks + ".txt")).string();
+    {
+        ofstream out(smallFile);
+        out << "Only Way\n1\n34.0547000 -118.4794734 34.0544590 -118.4801137\n";
+    }
+
+    MapHandle handle;
+    if(!handle.load(mapFile)){
+        fail("reload", g, 0, 0, "handle couldn't load " + mapFile);
+        filesystem::remove(smallFile);
+        return;
+    }
+    weak_ptr<const MapSnapshot> first = handle.snapshot();
+    atomic<bool> stop(false);
+    atomic<int> started(0);
+    vector<string> wrong(min(numThreads, 8));
+    vector<thread> readers;
+    for(size_t t = 0; t < wrong.size(); t++){
+        readers.push_back(thread([&, t]{
+            //held for the whole run, so the first version has to stay usable after it's replaced
+            shared_ptr<const MapSnapshot> held = handle.snapshot();
+            if(held->version() != 1)
+                wrong[t] += "first snapshot is version " + to_string(held->version()) + "; ";
+            started++;
+            RouteArena arena;
+            unsigned long lastVersion = 0;
+            for(size_t q = t; !stop || q < t + 2 * pairs.size(); q++){
+                size_t i = q % pairs.size();
+                shared_ptr<const MapSnapshot> snap = handle.snapshot();
+                if(snap->version() < lastVersion)
+                    wrong[t] += "version went from " + to_string(lastVersion) + " to " + to_string(snap->version()) + "; ";
+                lastVersion = snap->version();
+                bool full = snap->map().graph().nodeCount() == g.nodeCount();
+                const MapSnapshot& on = q % 2 == 0 ? *held : *snap;
+                EdgePath path;
+                double d = -1;
+                arena.reset();
+                DeliveryResult res = on.router().generatePointToPointRoute(g.coord(pairs[i].first), g.coord(pairs[i].second),
+                                                                          arena, path, d);
+                bool ok;
+                if(&on == held.get() || full)
+                    ok = expected[i] < 0 ? res == NO_ROUTE : res == DELIVERY_SUCCESS && nearlyEqual(d, expected[i]);
+                else
+                    ok = res == BAD_COORD;
+                if(!ok)
+                    wrong[t] += "pair " + to_string(i) + " on version " + to_string(on.version()) + " gave " + to_string(res) + "; ";
+            }
+        }));
+    }
+    while(started < (int)readers.size())
+        this_thread::yield();
+
+    future<bool> oneWay = handle.reloadAsync(smallFile);
+    future<bool> full = handle.reloadAsync(mapFile);
+    future<bool> missing = handle.reloadAsync(missingFile);
+    bool oneWayLoaded = oneWay.get(), fullLoaded = full.get(), missingLoaded = missing.get();
+    filesystem::remove(smallFile);
+    if(!oneWayLoaded || !fullLoaded)
+        fail("reload", g, 0, 0, "a reload of an existing map failed");
+    if(missingLoaded)
+        fail("reload", g, 0, 0, "a reload of a missing map succeeded");
+    shared_ptr<const MapSnapshot> last = handle.snapshot();
+    if(last->version() != 3 || last->map().graph().nodeCount() != g.nodeCount())
+        fail("reload", g, 0, 0, "version " + to_string(last->version()) + " with " + to_string(last->map().graph().nodeCount())
+             + " nodes is published, not version 3 with the full map");
+    stop = true;
+    for(size_t t = 0; t < readers.size(); t++){
+        readers[t].join();
+        if(!wrong[t].empty())
+            fail("reload, reader " + to_string(t), g, 0, 0, wrong[t]);
+    }
+    if(!first.expired())
+        fail("reload", g, 0, 0, "the first snapshot outlived its last reader");
+}
+
+int main(int argc, char *argv[])
+{
+    string mapFile = argc > 1 ? argv[1] : "mapdata.txt";
+    int numPairs = argc > 2 ? atoi(argv[2]) : 2000;
+    unsigned int seed = argc > 3 ? (unsigned int)atoi(argv[3]) : 1;
+    int numThreads = argc > 4 ? atoi(argv[4]) : 64;
+
+    StreetMap sm;
+    if(!sm.load(mapFile)){
+        cerr << "Unable to load map data file " << mapFile << endl;
+        return 1;
+    }
+    const StreetGraph& g = sm.graph();
+
+    if(!g.frozen())
+        fail("load", g, 0, 0, "graph isn't frozen after load");
+    ComponentReport components = g.componentReport();
+    if(exportedValue("streetmap_components") != components.count
+       || exportedValue("streetmap_nodes_outside_largest") != components.nodesOutsideLargest)
+        fail("load", g, 0, 0, "component gauges don't match the map's " + to_string(components.count) + " components");
+    if(numPairs > 0){
+        regressionTest(sm, numPairs, seed);
+        checkCompressed(mapFile, numPairs / 4, seed);
+        checkNodeOrders(mapFile, numPairs / 4, seed);
+        checkLargePages(g, mapFile, numPairs / 4, seed);
+    }
+    if(numThreads > 0){
+        stressTest(sm, numThreads, seed);
+        checkReload(sm, mapFile, numThreads, seed);
+    }
+
+    if(failures > 0){
+        cerr << failures << " failure(s), seed " << seed << endl;
+        return 1;
+    }
+    cout << "All routing modes match the reference on " << numPairs << " pairs and "
+         << numThreads << " threads (seed " << seed << ")" << endl;
+    return 0;
+}
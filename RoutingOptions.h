@@ -0,0 +1,59 @@
+#ifndef ROUTINGOPTIONS_INCLUDED
+#define ROUTINGOPTIONS_INCLUDED
+
+#include "StreetGraph.h"
+
+// RoutingOptions.h
+
+// Settings for a PointToPointRouter beyond the plain shortest-distance default.
+
+class EdgeWeights;
+
+  // Extra cost charged for turning from one segment onto the next, in the same units the
+  // search minimizes (miles by default, minutes with a travel-time layer).  Moving onto a
+  // different street is a turn the way the planner words its Turn commands: 1 to 180
+  // degrees counterclockwise is left, 180 to 359 is right.  Following the same street round
+  // a bend is free unless the bend is sharper than STREET_BEND degrees, so a curvy street
+  // isn't charged at every vertex.  Anything that heads back the way it came (within 10
+  // degrees of reversing) is a U-turn, whatever the names.  The defaults are miles; read as
+  // minutes they'd be a second or two, so a travel-time layer wants travelTime() instead.
+struct TurnCosts
+{
+    TurnCosts()
+     : left(0.05), right(0.01), uTurn(0.5)
+    {}
+      // defaults in minutes: 15 seconds for a left, 6 for a right and a minute to turn round
+    static TurnCosts travelTime()
+    {
+        TurnCosts t;
+        t.left = 0.25;
+        t.right = 0.1;
+        t.uTurn = 1;
+        return t;
+    }
+    static constexpr double STREET_BEND = 45;
+
+      // the penalty for driving from edge "from" straight onto edge "to", which must start
+      // where "from" ends
+    double between(const StreetGraph& g, EdgeId from, EdgeId to) const;
+
+    double left;
+    double right;
+    double uTurn;
+};
+
+struct RoutingOptions
+{
+    RoutingOptions()
+     : useTurnCosts(false), weights(nullptr)
+    {}
+      // switches the search from nodes to edges so the cost of a turn can depend on the
+      // segment the driver arrived on; roughly doubles the per-query search state
+    bool useTurnCosts;
+    TurnCosts turnCosts;
+      // per-edge costs to minimize instead of miles, e.g. EdgeWeights::travelTime (see
+      // SpeedProfile.h).  Not owned; reported route distances are still in miles.
+    const EdgeWeights* weights;
+};
+
+#endif // ROUTINGOPTIONS_INCLUDED
@@ -0,0 +1,149 @@
+#include "SpeedProfile.h"
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cctype>
+using namespace std;
+
+static string lowerCase(string_view s){
+    string out(s);
+    for(size_t i = 0; i < out.size(); i++)
+        out[i] = (char)tolower((unsigned char)out[i]);
+    return out;
+}
+
+static bool endsWith(const string& s, const string& suffix){
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+SpeedProfile::SpeedProfile() : m_defaultMph(25){
+    setSuffixSpeed("Freeway", 65);
+    setSuffixSpeed("Highway", 55);
+    setSuffixSpeed("Expressway", 55);
+    setSuffixSpeed("Parkway", 40);
+    setSuffixSpeed("Boulevard", 35);
+    setSuffixSpeed("Blvd", 35);
+    setSuffixSpeed("Avenue", 30);
+    setSuffixSpeed("Ave", 30);
+    setSuffixSpeed("Road", 30);
+    setSuffixSpeed("Street", 25);
+    setSuffixSpeed("Drive", 25);
+    setSuffixSpeed("Way", 25);
+    setSuffixSpeed("Canyon", 25);
+    setSuffixSpeed("Place", 20);
+    setSuffixSpeed("Lane", 20);
+    setSuffixSpeed("Circle", 20);
+    setSuffixSpeed("Terrace", 20);
+    setSuffixSpeed("Court", 15);
+    setSuffixSpeed("Driveway", 10);
+    setSuffixSpeed("Alley", 10);
+    setSuffixSpeed("Walk", 3);
+    setSuffixSpeed("Steps", 3);
+    setSuffixSpeed("Stairs", 3);
+}
+
+void SpeedProfile::set(vector<Entry>& entries, string name, double mph){
+    name = lowerCase(name);
+    for(size_t i = 0; i < entries.size(); i++){
+        if(entries[i].name == name){
+            entries[i].mph = mph;
+            return;
+        }
+    }
+    entries.push_back(Entry{name, mph});
+    //longest suffix first, so "Driveway" is tried before "Way"
+    stable_sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b){
+        return a.name.size() > b.name.size();
+    });
+}
+
+void SpeedProfile::setSuffixSpeed(string suffix, double mph){
+    set(m_suffixes, suffix, mph);
+}
+
+void SpeedProfile::setStreetSpeed(string name, double mph){
+    set(m_streets, name, mph);
+}
+
+bool SpeedProfile::loadOverrides(string overridesFile){
+    ifstream infile(overridesFile);
+    if(!infile)
+        return false;
+    string line;
+    while(getline(infile, line)){
+        istringstream in(line);
+        double mph;
+        if(!(in >> mph)){
+            //blank and comment lines are fine, anything else is a bad line
+            string word;
+            istringstream check(line);
+            if(!(check >> word) || word[0] == '#')
+                continue;
+            return false;
+        }
+        string name;
+        getline(in >> ws, name);
+        if(mph <= 0 || name.empty())
+            return false;
+        if(name[0] == '*')
+            setSuffixSpeed(name.substr(1), mph);
+        else
+            setStreetSpeed(name, mph);
+    }
+    return true;
+}
+
+//an exact street entry wins, then the longest matching suffix. Trailing compass words
+//("Sepulveda Boulevard South") are skipped when matching suffixes.
+double SpeedProfile::speedFor(string_view streetName) const{
+    string name = lowerCase(streetName);
+    for(size_t i = 0; i < m_streets.size(); i++){
+        if(m_streets[i].name == name)
+            return m_streets[i].mph;
+    }
+    static const char* const compass[] = {" north", " south", " east", " west"};
+    for(int i = 0; i < 4; i++){
+        if(endsWith(name, compass[i])){
+            name.erase(name.size() - char_traits<char>::length(compass[i]));
+            break;
+        }
+    }
+    for(size_t i = 0; i < m_suffixes.size(); i++){
+        const string& suffix = m_suffixes[i].name;
+        //whole words only: "Broadway" is not a "Way"
+        if(endsWith(name, suffix) && (name.size() == suffix.size() || name[name.size() - suffix.size() - 1] == ' '))
+            return m_suffixes[i].mph;
+    }
+    return m_defaultMph;
+}
+
+double SpeedProfile::maxSpeed() const{
+    double fastest = m_defaultMph;
+    for(size_t i = 0; i < m_suffixes.size(); i++)
+        fastest = max(fastest, m_suffixes[i].mph);
+    for(size_t i = 0; i < m_streets.size(); i++)
+        fastest = max(fastest, m_streets[i].mph);
+    return fastest;
+}
+
+//speeds are looked up once per street name rather than once per edge
+EdgeWeights EdgeWeights::travelTime(const StreetGraph& g, const SpeedProfile& profile){
+    EdgeWeights w;
+    vector<double> minutesPerMile;
+    w.m_weight.resize(g.edgeCount());
+    w.m_minPerMile = 60 / profile.maxSpeed();
+    //node by node, so each edge's ends are at hand even when the graph is compressed
+    EdgeId e;
+    NodeId to;
+    for(NodeId from = 0; from < (NodeId)g.nodeCount(); from++){
+        for(StreetGraph::EdgeCursor c = g.edgesOf(from); c.next(e, to); ){
+            NameId name = g.edgeNameId(e);
+            if(name >= minutesPerMile.size())
+                minutesPerMile.resize(name + 1, 0);
+            if(minutesPerMile[name] == 0)
+                minutesPerMile[name] = 60 / profile.speedFor(g.streetName(name));
+            w.m_weight[e] = g.edgeLength(e, from, to) * minutesPerMile[name];
+        }
+    }
+    return w;
+}
@@ -0,0 +1,67 @@
+#ifndef SPEEDPROFILE_INCLUDED
+#define SPEEDPROFILE_INCLUDED
+
+#include "StreetGraph.h"
+#include <string>
+#include <string_view>
+#include <vector>
+
+// SpeedProfile.h
+
+// Travel speeds for the streets in a map.  The map file only carries names, so a street's
+// class is read off the last word of its name ("Freeway", "Boulevard", "Drive", ...) and
+// looked up in a suffix table.  An overrides file can change the table or pin the speed of
+// individual streets; each line is a speed in mph followed by a name:
+//
+//     65 *Freeway          every street whose name ends in Freeway
+//     40 Sunset Boulevard  just this street
+//
+// Blank lines and lines starting with # are ignored.
+
+class SpeedProfile
+{
+public:
+      // the built-in suffix table
+    SpeedProfile();
+      // false if the file can't be opened or a line doesn't start with a positive speed
+    bool loadOverrides(std::string overridesFile);
+    void setSuffixSpeed(std::string suffix, double mph);
+    void setStreetSpeed(std::string name, double mph);
+      // used for names that match nothing else
+    void setDefaultSpeed(double mph) { m_defaultMph = mph; }
+    double speedFor(std::string_view streetName) const;
+      // the fastest speed any street can get; keeps A* admissible on time weights
+    double maxSpeed() const;
+
+private:
+    struct Entry {
+        std::string name;       // lower case
+        double mph;
+    };
+    std::vector<Entry> m_suffixes;
+    std::vector<Entry> m_streets;
+    double m_defaultMph;
+    static void set(std::vector<Entry>& entries, std::string name, double mph);
+};
+
+  // One weight per edge of a StreetGraph, kept apart from the graph so any number of
+  // metrics can share one loaded topology.  Pass a layer to a router through
+  // RoutingOptions::weights; the layer must outlive the routers that use it.
+class EdgeWeights
+{
+public:
+      // minutes to drive each edge at the profile's speed for its street
+    static EdgeWeights travelTime(const StreetGraph& g, const SpeedProfile& profile);
+
+    double weight(EdgeId e) const { return m_weight[e]; }
+      // no edge costs less than this per mile of its length, so scaling a crow-flies
+      // distance by it gives an admissible A* heuristic
+    double minPerMile() const { return m_minPerMile; }
+    int size() const { return (int)m_weight.size(); }
+
+private:
+    std::vector<double> m_weight;
+    double m_minPerMile;
+};
+
+#endif // SPEEDPROFILE_INCLUDED
@@ -0,0 +1,604 @@
+#include "StreetGraph.h"
+#include <algorithm>
+#include <limits>
+#include <cmath>
+using namespace std;
+
+//******************** RouteArena functions ***********************************
+
+RouteArena::RouteArena(size_t firstBlockEdges)
+ : m_curBlock(0), m_used(0), m_nextSize(firstBlockEdges > 0 ? firstBlockEdges : 1){
+}
+
+RouteArena::~RouteArena(){
+    for(size_t i = 0; i < m_blocks.size(); i++)
+        delete[] m_blocks[i].data;
+}
+
+EdgeId* RouteArena::allocate(size_t n){
+    //walk forward through blocks kept from before the last reset before asking for more
+    while(m_curBlock < m_blocks.size()){
+        Block& b = m_blocks[m_curBlock];
+        if(b.size - m_used >= n){
+            EdgeId* p = b.data + m_used;
+            m_used += n;
+            return p;
+        }
+        m_curBlock++;
+        m_used = 0;
+    }
+    size_t size = max(m_nextSize, n);
+    m_nextSize = size * 2;
+    Block b;
+    b.data = new EdgeId[size];
+    b.size = size;
+    m_blocks.push_back(b);
+    m_curBlock = m_blocks.size() - 1;
+    m_used = n;
+    return b.data;
+}
+
+void RouteArena::reset(){
+    m_curBlock = 0;
+    m_used = 0;
+}
+
+size_t RouteArena::capacity() const{
+    size_t total = 0;
+    for(size_t i = 0; i < m_blocks.size(); i++)
+        total += m_blocks[i].size;
+    return total;
+}
+
+//******************** StreetGraph functions **********************************
+
+double crowDistanceMiles(double lat1, double lon1, double lat2, double lon2){
+    //GeoCoord's default constructor doesn't parse anything, so this stays cheap
+    GeoCoord a, b;
+    a.latitude = lat1;
+    a.longitude = lon1;
+    b.latitude = lat2;
+    b.longitude = lon2;
+    return distanceEarthMiles(a, b);
+}
+
+StreetGraph::StreetGraph() : m_compact(false), m_compressed(false), m_primary(nullptr){
+    m_index = new ExpandableHashMap<GeoCoord, NodeId>;
+    m_fixedIndex = new ExpandableHashMap<unsigned long long, NodeId>;
+    m_firstEdge.push_back(0);
+}
+
+StreetGraph::~StreetGraph(){
+    deleteReplicas();
+    delete m_index;
+    delete m_fixedIndex;
+}
+
+//empties v and makes its future storage follow policy
+template<typename T>
+static void resetArray(LargeVector<T>& v, const LargePagePolicy& policy){
+    v = LargeVector<T>(LargePageAllocator<T>(policy));
+}
+
+void StreetGraph::clear(const MapLoadOptions& options){
+    deleteReplicas();
+    m_compact = options.compactStorage || options.compressedEdges;
+    m_compressed = false;
+    delete m_index;
+    m_index = new ExpandableHashMap<GeoCoord, NodeId>;
+    delete m_fixedIndex;
+    m_fixedIndex = new ExpandableHashMap<unsigned long long, NodeId>;
+    LargePagePolicy policy;
+    policy.hugePages = options.hugePages;
+    resetArray(m_lat, policy);
+    resetArray(m_lon, policy);
+    m_latText.clear();
+    m_lonText.clear();
+    resetArray(m_fixedLat, policy);
+    resetArray(m_fixedLon, policy);
+    resetArray(m_firstEdge, policy);
+    m_firstEdge.assign(1, 0);
+    resetArray(m_source, policy);
+    resetArray(m_target, policy);
+    resetArray(m_length, policy);
+    resetArray(m_angle, policy);
+    resetArray(m_nameOf, policy);
+    resetArray(m_targetBytes, policy);
+    resetArray(m_targetOffset, policy);
+    m_names.clear();
+    resetArray(m_component, policy);
+    m_componentSize.clear();
+    m_pending.clear();
+}
+
+void StreetGraph::deleteReplicas(){
+    for(StreetGraph* r : m_replicas)
+        delete r;
+    m_replicas.clear();
+    m_byNode.clear();
+}
+
+//The loader's own copy serves its node; every other node gets a replica whose pages are
+//bound there before the copy first touches them.
+void StreetGraph::replicate(const MapLoadOptions& options){
+    int nodes = numaNodeCount();
+    if(nodes < 2)
+        return;
+    int home = currentNumaNode();
+    m_byNode.assign(nodes, this);
+    for(int node = 0; node < nodes; node++){
+        if(node == home)
+            continue;
+        LargePagePolicy policy;
+        policy.hugePages = options.hugePages;
+        policy.numaNode = node;
+        StreetGraph* r = new StreetGraph;
+        r->copySearchArrays(*this, policy);
+        m_replicas.push_back(r);
+        m_byNode[node] = r;
+    }
+}
+
+template<typename T>
+static void copyArray(LargeVector<T>& to, const LargeVector<T>& from, const LargePagePolicy& policy){
+    to = LargeVector<T>(from.begin(), from.end(), LargePageAllocator<T>(policy));
+}
+
+void StreetGraph::copySearchArrays(const StreetGraph& from, const LargePagePolicy& policy){
+    m_primary = &from;
+    m_compact = from.m_compact;
+    copyArray(m_lat, from.m_lat, policy);
+    copyArray(m_lon, from.m_lon, policy);
+    copyArray(m_fixedLat, from.m_fixedLat, policy);
+    copyArray(m_fixedLon, from.m_fixedLon, policy);
+    copyArray(m_firstEdge, from.m_firstEdge, policy);
+    copyArray(m_source, from.m_source, policy);
+    copyArray(m_target, from.m_target, policy);
+    copyArray(m_length, from.m_length, policy);
+    copyArray(m_angle, from.m_angle, policy);
+    copyArray(m_nameOf, from.m_nameOf, policy);
+    m_compressed = from.m_compressed;
+    copyArray(m_targetBytes, from.m_targetBytes, policy);
+    copyArray(m_targetOffset, from.m_targetOffset, policy);
+    copyArray(m_component, from.m_component, policy);
+    m_names = from.m_names;
+    m_componentSize = from.m_componentSize;
+    m_index->freeze();
+    m_fixedIndex->freeze();
+}
+
+size_t StreetGraph::searchArrayBytes() const{
+    return (m_lat.capacity() + m_lon.capacity() + m_length.capacity() + m_angle.capacity()) * sizeof(double)
+         + (m_fixedLat.capacity() + m_fixedLon.capacity() + m_component.capacity()) * sizeof(int)
+         + (m_firstEdge.capacity() + m_source.capacity() + m_target.capacity() + m_nameOf.capacity()) * sizeof(EdgeId)
+         + m_targetBytes.capacity() + m_targetOffset.capacity() * sizeof(unsigned int)
+         + m_names.memoryBytes();
+}
+
+const StreetGraph& StreetGraph::local() const{
+    if(m_byNode.empty())
+        return *this;
+    int node = currentNumaNode();
+    return node < (int)m_byNode.size() ? *m_byNode[node] : *this;
+}
+
+long long StreetGraph::toFixed(double degrees){
+    return llround(degrees * FIXED_SCALE);
+}
+
+//latitude in the high half, both offset so they're non-negative
+unsigned long long StreetGraph::fixedKey(const GeoCoord& gc){
+    unsigned long long lat = (unsigned long long)(toFixed(gc.latitude) + 900000000LL);
+    unsigned long long lon = (unsigned long long)(toFixed(gc.longitude) + 1800000000LL);
+    return (lat << 32) | (lon & 0xffffffffULL);
+}
+
+bool StreetGraph::findNode(const GeoCoord& gc, NodeId& node) const{
+    if(m_primary != nullptr)
+        return m_primary->findNode(gc, node);
+    //through const references, so the lookups are the read-only ones
+    const ExpandableHashMap<GeoCoord, NodeId>& index = *m_index;
+    const ExpandableHashMap<unsigned long long, NodeId>& fixedIndex = *m_fixedIndex;
+    const NodeId* found = m_compact ? fixedIndex.find(fixedKey(gc)) : index.find(gc);
+    if(found == nullptr)
+        return false;
+    node = *found;
+    return true;
+}
+
+double StreetGraph::crowDistance(NodeId a, NodeId b) const{
+    return crowDistanceMiles(latitude(a), longitude(a), latitude(b), longitude(b));
+}
+
+EdgeId StreetGraph::reverseEdge(EdgeId e) const{
+    NodeId u = edgeSource(e), v = edgeTarget(e);
+    EdgeId any = NO_EDGE;
+    EdgeId f;
+    NodeId to;
+    for(EdgeCursor c = edgesOf(v); c.next(f, to); ){
+        if(to != u)
+            continue;
+        //two streets can join the same pair of points; keep the name
+        if(m_nameOf[f] == m_nameOf[e])
+            return f;
+        any = f;
+    }
+    return any;
+}
+
+//prints a fixed-point coordinate with all 7 decimals, the way the map files write them
+static string fixedText(int value){
+    string text = value < 0 ? "-" : "";
+    long long v = value < 0 ? -(long long)value : value;
+    string frac = to_string(v % 10000000);
+    return text + to_string(v / 10000000) + "." + string(7 - frac.size(), '0') + frac;
+}
+
+GeoCoord StreetGraph::coord(NodeId n) const{
+    if(m_primary != nullptr)
+        return m_primary->coord(n);
+    GeoCoord gc;
+    if(m_compact){
+        gc.latitudeText = fixedText(m_fixedLat[n]);
+        gc.longitudeText = fixedText(m_fixedLon[n]);
+        gc.latitude = latitude(n);
+        gc.longitude = longitude(n);
+        return gc;
+    }
+    gc.latitudeText = m_latText[n];
+    gc.longitudeText = m_lonText[n];
+    gc.latitude = m_lat[n];
+    gc.longitude = m_lon[n];
+    return gc;
+}
+
+StreetSegment StreetGraph::segment(EdgeId e) const{
+    return StreetSegment(coord(edgeSource(e)), coord(edgeTarget(e)), string(edgeName(e)));
+}
+
+void StreetGraph::materialize(const EdgePath& path, list<StreetSegment>& route) const{
+    route.clear();
+    for(size_t i = 0; i < path.size(); i++)
+        route.push_back(segment(path[i]));
+}
+
+void StreetGraph::materialize(const EdgePath& path, vector<StreetSegment>& route) const{
+    route.clear();
+    route.reserve(path.size());
+    for(size_t i = 0; i < path.size(); i++)
+        route.push_back(segment(path[i]));
+}
+
+NodeId StreetGraph::addNode(const GeoCoord& gc){
+    if(m_compact){
+        unsigned long long key = fixedKey(gc);
+        const NodeId* found = m_fixedIndex->find(key);
+        if(found != nullptr)
+            return *found;
+        NodeId id = (NodeId)m_fixedLat.size();
+        m_fixedIndex->associate(key, id);
+        m_fixedLat.push_back((int)toFixed(gc.latitude));
+        m_fixedLon.push_back((int)toFixed(gc.longitude));
+        return id;
+    }
+    const NodeId* found = m_index->find(gc);
+    if(found != nullptr)
+        return *found;
+    NodeId id = (NodeId)m_lat.size();
+    m_index->associate(gc, id);
+    m_lat.push_back(gc.latitude);
+    m_lon.push_back(gc.longitude);
+    m_latText.push_back(gc.latitudeText);
+    m_lonText.push_back(gc.longitudeText);
+    return id;
+}
+
+NameId StreetGraph::addName(const string& name){
+    return m_names.intern(name);
+}
+
+void StreetGraph::addSegment(NodeId from, NodeId to, NameId name){
+    PendingSegment p;
+    p.from = from;
+    p.to = to;
+    p.name = name;
+    m_pending.push_back(p);
+}
+
+void StreetGraph::finish(const MapLoadOptions& options){
+    buildEdges();
+    if(options.nodeOrder != FILE_ORDER){
+        vector<NodeId> newId;
+        if(options.nodeOrder == HILBERT_ORDER)
+            hilbertOrder(newId);
+        else
+            bfsOrder(newId);
+        renumber(newId);
+    }
+    labelComponents();
+    if(options.compressedEdges)
+        compressEdges();
+    m_index->freeze();
+    m_fixedIndex->freeze();
+    if(options.numaReplicas)
+        replicate(options);
+}
+
+//turns the pending segment list into CSR arrays with a counting sort on the source node,
+//keeping file order within each node so getSegmentsThatStartWith's order doesn't change
+void StreetGraph::buildEdges(){
+    size_t n = nodeCount();
+    m_firstEdge.assign(n + 1, 0);
+    for(size_t i = 0; i < m_pending.size(); i++)
+        m_firstEdge[m_pending[i].from + 1]++;
+    for(size_t i = 0; i < n; i++)
+        m_firstEdge[i + 1] += m_firstEdge[i];
+
+    size_t m = m_pending.size();
+    m_source.resize(m);
+    m_target.resize(m);
+    m_length.resize(m);
+    m_angle.resize(m);
+    m_nameOf.resize(m);
+    vector<EdgeId> next(m_firstEdge.begin(), m_firstEdge.end() - 1);
+    for(size_t i = 0; i < m; i++){
+        const PendingSegment& p = m_pending[i];
+        EdgeId e = next[p.from]++;
+        m_source[e] = p.from;
+        m_target[e] = p.to;
+        m_nameOf[e] = p.name;
+        m_length[e] = crowDistance(p.from, p.to);
+        m_angle[e] = angleBetween(p.from, p.to);
+    }
+    vector<PendingSegment>().swap(m_pending);
+    m_names.shrink();
+}
+
+double StreetGraph::angleBetween(NodeId from, NodeId to) const{
+    double angle = rad2deg(atan2(latitude(to) - latitude(from), longitude(to) - longitude(from)));
+    return angle < 0 ? angle + 360 : angle;
+}
+
+//Runs last, once the node order is settled: the nearer renumbering puts a node's neighbours
+//to it, the fewer bytes each delta takes.  Lengths and angles come back out of the same
+//coordinates the same way, so nothing a search sees changes but its speed.
+void StreetGraph::compressEdges(){
+    size_t n = nodeCount();
+    m_targetOffset.assign(n + 1, 0);
+    m_targetBytes.clear();
+    m_targetBytes.reserve(m_target.size() * 2);
+    for(NodeId u = 0; u < n; u++){
+        m_targetOffset[u] = (unsigned int)m_targetBytes.size();
+        for(EdgeId e = m_firstEdge[u]; e != m_firstEdge[u + 1]; e++){
+            unsigned int v = zigzag((int)(m_target[e] - u));
+            for(; v >= 0x80; v >>= 7)
+                m_targetBytes.push_back((unsigned char)(v | 0x80));
+            m_targetBytes.push_back((unsigned char)v);
+        }
+    }
+    m_targetOffset[n] = (unsigned int)m_targetBytes.size();
+    m_targetBytes.shrink_to_fit();
+    LargePagePolicy policy = m_target.get_allocator().policy();
+    resetArray(m_source, policy);
+    resetArray(m_target, policy);
+    resetArray(m_length, policy);
+    resetArray(m_angle, policy);
+    m_compressed = true;
+}
+
+//the node whose edge range holds e
+NodeId StreetGraph::compressedSource(EdgeId e) const{
+    return (NodeId)(upper_bound(m_firstEdge.begin(), m_firstEdge.end(), e) - m_firstEdge.begin() - 1);
+}
+
+NodeId StreetGraph::compressedTarget(EdgeId e) const{
+    NodeId u = compressedSource(e);
+    EdgeId f;
+    NodeId to = NO_NODE;
+    for(EdgeCursor c = edgesOf(u); c.next(f, to) && f != e; )
+        ;
+    return to;
+}
+
+//position of (x, y) along a Hilbert curve filling a 2^16 x 2^16 grid
+static unsigned long long hilbertIndex(unsigned int x, unsigned int y){
+    unsigned long long d = 0;
+    for(unsigned int s = 1u << 15; s > 0; s >>= 1){
+        unsigned int rx = (x & s) > 0;
+        unsigned int ry = (y & s) > 0;
+        d += (unsigned long long)s * s * ((3 * rx) ^ ry);
+        if(ry == 0){
+            if(rx == 1){
+                x = s - 1 - x;
+                y = s - 1 - y;
+            }
+            unsigned int t = x;
+            x = y;
+            y = t;
+        }
+    }
+    return d;
+}
+
+void StreetGraph::hilbertOrder(vector<NodeId>& newId) const{
+    size_t n = nodeCount();
+    newId.resize(n);
+    if(n == 0) return;
+    double minLat = latitude(0), maxLat = minLat, minLon = longitude(0), maxLon = minLon;
+    for(NodeId i = 1; i < n; i++){
+        minLat = min(minLat, latitude(i));
+        maxLat = max(maxLat, latitude(i));
+        minLon = min(minLon, longitude(i));
+        maxLon = max(maxLon, longitude(i));
+    }
+    double latScale = maxLat > minLat ? 65535 / (maxLat - minLat) : 0;
+    double lonScale = maxLon > minLon ? 65535 / (maxLon - minLon) : 0;
+
+    vector<pair<unsigned long long, NodeId> > keyed(n);
+    for(NodeId i = 0; i < n; i++){
+        unsigned int x = (unsigned int)((longitude(i) - minLon) * lonScale);
+        unsigned int y = (unsigned int)((latitude(i) - minLat) * latScale);
+        keyed[i] = make_pair(hilbertIndex(x, y), i);
+    }
+    sort(keyed.begin(), keyed.end());
+    for(size_t i = 0; i < n; i++)
+        newId[keyed[i].second] = (NodeId)i;
+}
+
+void StreetGraph::bfsOrder(vector<NodeId>& newId) const{
+    size_t n = nodeCount();
+    vector<NodeId> byDegree(n), order;
+    for(NodeId i = 0; i < n; i++)
+        byDegree[i] = i;
+    auto degree = [&](NodeId v){ return m_firstEdge[v + 1] - m_firstEdge[v]; };
+    stable_sort(byDegree.begin(), byDegree.end(), [&](NodeId a, NodeId b){ return degree(a) < degree(b); });
+
+    //each component is started from its lowest-degree node, which tends to sit at its edge
+    vector<bool> seen(n, false);
+    vector<NodeId> neighbors;
+    for(size_t k = 0; k < n; k++){
+        if(seen[byDegree[k]]) continue;
+        size_t head = order.size();
+        order.push_back(byDegree[k]);
+        seen[byDegree[k]] = true;
+        for(; head < order.size(); head++){
+            NodeId cur = order[head];
+            neighbors.clear();
+            for(EdgeId e = m_firstEdge[cur]; e != m_firstEdge[cur + 1]; e++){
+                if(!seen[m_target[e]]){
+                    seen[m_target[e]] = true;
+                    neighbors.push_back(m_target[e]);
+                }
+            }
+            stable_sort(neighbors.begin(), neighbors.end(), [&](NodeId a, NodeId b){ return degree(a) < degree(b); });
+            order.insert(order.end(), neighbors.begin(), neighbors.end());
+        }
+    }
+    newId.resize(n);
+    for(size_t i = 0; i < n; i++)
+        newId[order[i]] = (NodeId)(n - 1 - i);
+}
+
+//moves node i to newId[i] in every node array and the coordinate index, then rebuilds the
+//edge arrays so each node's segments keep their relative order
+void StreetGraph::renumber(const vector<NodeId>& newId){
+    size_t n = nodeCount();
+    if(m_compact){
+        LargeVector<int> lat(n, 0, m_fixedLat.get_allocator()), lon(n, 0, m_fixedLon.get_allocator());
+        for(size_t i = 0; i < n; i++){
+            lat[newId[i]] = m_fixedLat[i];
+            lon[newId[i]] = m_fixedLon[i];
+        }
+        m_fixedLat.swap(lat);
+        m_fixedLon.swap(lon);
+        for(NodeId i = 0; i < n; i++)
+            m_fixedIndex->associate(fixedKey(coord(i)), i);
+    } else {
+        LargeVector<double> lat(n, 0, m_lat.get_allocator()), lon(n, 0, m_lon.get_allocator());
+        vector<string> latText(n), lonText(n);
+        for(size_t i = 0; i < n; i++){
+            NodeId to = newId[i];
+            lat[to] = m_lat[i];
+            lon[to] = m_lon[i];
+            latText[to].swap(m_latText[i]);
+            lonText[to].swap(m_lonText[i]);
+        }
+        m_lat.swap(lat);
+        m_lon.swap(lon);
+        m_latText.swap(latText);
+        m_lonText.swap(lonText);
+        for(NodeId i = 0; i < n; i++)
+            m_index->associate(coord(i), i);
+    }
+
+    m_pending.resize(m_target.size());
+    for(EdgeId e = 0; e < m_target.size(); e++){
+        m_pending[e].from = newId[m_source[e]];
+        m_pending[e].to = newId[m_target[e]];
+        m_pending[e].name = m_nameOf[e];
+    }
+    buildEdges();
+}
+
+//breadth-first flood fill from every unlabeled node, then renumber so component 0 is the largest
+void StreetGraph::labelComponents(){
+    size_t n = nodeCount();
+    m_component.assign(n, -1);
+    vector<int> sizes;
+    vector<NodeId> queue;
+    for(NodeId seed = 0; seed < n; seed++){
+        if(m_component[seed] >= 0)
+            continue;
+        int label = (int)sizes.size();
+        queue.clear();
+        queue.push_back(seed);
+        m_component[seed] = label;
+        for(size_t head = 0; head < queue.size(); head++){
+            NodeId cur = queue[head];
+            for(EdgeId e = m_firstEdge[cur]; e != m_firstEdge[cur + 1]; e++){
+                if(m_component[m_target[e]] < 0){
+                    m_component[m_target[e]] = label;
+                    queue.push_back(m_target[e]);
+                }
+            }
+        }
+        sizes.push_back((int)queue.size());
+    }
+
+    vector<int> bySize(sizes.size());
+    for(size_t i = 0; i < bySize.size(); i++)
+        bySize[i] = (int)i;
+    stable_sort(bySize.begin(), bySize.end(), [&](int a, int b){ return sizes[a] > sizes[b]; });
+    vector<int> relabel(sizes.size());
+    m_componentSize.resize(sizes.size());
+    for(size_t i = 0; i < bySize.size(); i++){
+        relabel[bySize[i]] = (int)i;
+        m_componentSize[i] = sizes[bySize[i]];
+    }
+    for(size_t i = 0; i < n; i++)
+        m_component[i] = relabel[m_component[i]];
+}
+
+ComponentReport StreetGraph::componentReport() const{
+    ComponentReport r;
+    r.count = (int)m_componentSize.size();
+    r.sizes = m_componentSize;
+    r.nodesOutsideLargest = r.count > 0 ? nodeCount() - m_componentSize[0] : 0;
+    return r;
+}
+
+//heap bytes behind a string, zero when it fits in the small-string buffer
+static size_t textBytes(const string& s){
+    return s.capacity() > string().capacity() ? s.capacity() + 1 : 0;
+}
+
+MemoryStats StreetGraph::memoryStats() const{
+    if(m_primary != nullptr)
+        return m_primary->memoryStats();
+    MemoryStats m;
+    m.nodes = m_lat.capacity() * sizeof(double) + m_lon.capacity() * sizeof(double)
+            + m_latText.capacity() * sizeof(string) + m_lonText.capacity() * sizeof(string)
+            + m_fixedLat.capacity() * sizeof(int) + m_fixedLon.capacity() * sizeof(int)
+            + m_component.capacity() * sizeof(int) + m_componentSize.capacity() * sizeof(int);
+    size_t keyText = 0;
+    for(size_t i = 0; i < m_latText.size(); i++)
+        keyText += textBytes(m_latText[i]) + textBytes(m_lonText[i]);
+    m.nodes += keyText;
+
+    m.edges = m_firstEdge.capacity() * sizeof(EdgeId) + m_source.capacity() * sizeof(NodeId)
+            + m_target.capacity() * sizeof(NodeId) + m_length.capacity() * sizeof(double)
+            + m_angle.capacity() * sizeof(double) + m_nameOf.capacity() * sizeof(NameId)
+            + m_targetBytes.capacity() + m_targetOffset.capacity() * sizeof(unsigned int)
+            + m_pending.capacity() * sizeof(PendingSegment);
+    m.names = m_names.memoryBytes();
+
+    //each index key is a copy of its node's GeoCoord, text included
+    m.index = m_index->size() * ExpandableHashMap<GeoCoord, NodeId>::entryBytes() + keyText
+            + m_fixedIndex->size() * ExpandableHashMap<unsigned long long, NodeId>::entryBytes();
+    m.hashOverhead = m_index->bucketCount() * ExpandableHashMap<GeoCoord, NodeId>::bucketBytes()
+            + m_fixedIndex->bucketCount() * ExpandableHashMap<unsigned long long, NodeId>::bucketBytes();
+    m.replicas = 0;
+    for(const StreetGraph* r : m_replicas)
+        m.replicas += r->searchArrayBytes();
+    return m;
+}
@@ -0,0 +1,340 @@
+#ifndef STREETGRAPH_INCLUDED
+#define STREETGRAPH_INCLUDED
+
+#include "provided.h"
+#include "ExpandableHashMap.h"
+#include "StringPool.h"
+#include "LargePages.h"
+#include <string>
+#include <vector>
+#include <list>
+#include <cstddef>
+
+// StreetGraph.h
+
+// Compact, read-only form of a loaded StreetMap.  Every distinct GeoCoord in the map
+// file becomes a node with a 32-bit id and every directed street segment becomes an
+// edge with a 32-bit id.  Edges are stored in compressed sparse row order, so the
+// segments that start at node n are exactly the edge ids firstEdge(n)..lastEdge(n)-1.
+//
+// Once loading finishes the graph is frozen: the coordinate indexes refuse changes and
+// nothing reachable from a const StreetGraph is modified, cached or lazily built, so any
+// number of threads can route over one graph without locks or copies.  Only loading a new
+// file into the same StreetMap needs the readers to have stopped first.
+//
+// The arrays a search walks (coordinates, CSR offsets, per-edge data, components) can be
+// put on huge pages and copied once per NUMA node; see MapLoadOptions.  local() then hands
+// each thread the copy on its own node.  Node and edge ids are the same in every copy.
+//
+// With compressed edges the per-edge source, target, length and angle arrays are dropped.
+// Each node's targets are kept as varint deltas from the node's own id, which renumbering
+// keeps small, and lengths and angles are recomputed from the coordinates when asked for.
+// Search loops should walk adjacency with edgesOf(), which decodes targets in order.
+
+typedef unsigned int NodeId;
+typedef unsigned int EdgeId;
+
+const NodeId NO_NODE = 0xffffffff;
+const EdgeId NO_EDGE = 0xffffffff;
+
+  // A route as a run of edge ids.  The ids themselves live in a RouteArena (or any
+  // other buffer that outlives the path); an EdgePath never owns them.
+struct EdgePath
+{
+    EdgePath() : edges(nullptr), count(0) {}
+    EdgePath(const EdgeId* e, size_t n) : edges(e), count(n) {}
+
+    const EdgeId* begin() const { return edges; }
+    const EdgeId* end() const { return edges + count; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    EdgeId operator[](size_t i) const { return edges[i]; }
+
+    const EdgeId* edges;
+    size_t count;
+};
+
+  // Monotonic buffer for EdgePaths.  Allocation is a pointer bump; memory is only given
+  // back by reset() or destruction, at which point every path carved from it dies too.
+  // One arena per request (or per worker, reset between requests) keeps a whole plan's
+  // routes in a handful of blocks instead of one heap node per segment.
+class RouteArena
+{
+public:
+    RouteArena(size_t firstBlockEdges = 1024);
+    ~RouteArena();
+    EdgeId* allocate(size_t n);
+    void reset();
+    size_t capacity() const;
+
+      // C++11 syntax for preventing copying and assignment
+    RouteArena(const RouteArena&) = delete;
+    RouteArena& operator=(const RouteArena&) = delete;
+
+private:
+    struct Block {
+        EdgeId* data;
+        size_t size;
+    };
+    std::vector<Block> m_blocks;
+    size_t m_curBlock;
+    size_t m_used;
+    size_t m_nextSize;
+};
+
+  // Node numbering applied once the map file is read.  File order follows the street
+  // names in the file, so neighbours on the ground end up far apart in the arrays; the
+  // other two renumber nodes so a search walks mostly contiguous memory.
+enum NodeOrder
+{
+    FILE_ORDER,
+    HILBERT_ORDER,      // along a Hilbert curve over the map's bounding box
+    BFS_ORDER           // reverse Cuthill-McKee: breadth first, low degree first, reversed
+};
+
+struct MapLoadOptions
+{
+    MapLoadOptions()
+     : nodeOrder(HILBERT_ORDER), compactStorage(false), compressedEdges(false), hugePages(false),
+       numaReplicas(false)
+    {}
+      // HILBERT_ORDER unless set, so node and edge ids don't follow the map file; pick
+      // FILE_ORDER to keep the file's numbering.  Routes and distances are the same either way.
+    NodeOrder nodeOrder;
+      // keep coordinates as 32-bit fixed point (1e-7 degree) instead of two doubles and
+      // two strings per node.  Coordinates are then matched by value at that precision
+      // rather than by text, and the text of a GeoCoord handed back is always printed
+      // with 7 decimals, which is what the map files use.
+    bool compactStorage;
+      // keep edge targets as varint deltas and recompute lengths and angles from the
+      // coordinates, about 5 bytes per edge instead of 28; implies compactStorage.  Finding
+      // an edge's source then costs a binary search and its target a decode of its node's
+      // list, so routes come out the same but each search runs somewhat slower.
+    bool compressedEdges;
+      // back the search arrays with huge pages (explicit if the system has a pool, else
+      // transparent), which takes most TLB misses out of a search over a large map
+    bool hugePages;
+      // on a machine with several NUMA nodes, keep a copy of the search arrays bound to
+      // each node so threads never route over remote memory; costs one more copy of those
+      // arrays per extra node, and does nothing on a single node
+    bool numaReplicas;
+};
+
+  // Bytes held by a loaded map, by part.  Vectors are counted at capacity and hash
+  // entries at their node size, so this is what the process actually holds, give or
+  // take allocator overhead.
+struct MemoryStats
+{
+    size_t nodes;           // coordinates, coordinate text and component labels
+    size_t edges;           // CSR offsets and the per-edge arrays
+    size_t names;           // interned street names
+    size_t index;           // coordinate -> node entries, keys included
+    size_t hashOverhead;    // bucket array of the coordinate index
+    size_t replicas;        // per-NUMA-node copies of the search arrays
+    size_t total() const { return nodes + edges + names + index + hashOverhead + replicas; }
+};
+
+  // How the map splits into pieces that can't reach each other.  Every segment is loaded
+  // in both directions, so weakly and strongly connected components are the same thing.
+  // Component 0 is the largest; anything outside it usually means a data problem.
+struct ComponentReport
+{
+    int count;
+    std::vector<int> sizes;     // nodes per component, largest first
+    int nodesOutsideLargest;
+};
+
+class StreetGraph
+{
+public:
+    StreetGraph();
+    ~StreetGraph();
+
+    int nodeCount() const { return (int)(m_compact ? m_fixedLat.size() : m_lat.size()); }
+    int edgeCount() const { return (int)m_firstEdge.back(); }
+
+      // node ids for coordinates that appear in the map, false for anything else
+    bool findNode(const GeoCoord& gc, NodeId& node) const;
+
+    EdgeId firstEdge(NodeId n) const { return m_firstEdge[n]; }
+    EdgeId lastEdge(NodeId n) const { return m_firstEdge[n + 1]; }
+    NodeId edgeSource(EdgeId e) const { return m_compressed ? compressedSource(e) : m_source[e]; }
+    NodeId edgeTarget(EdgeId e) const { return m_compressed ? compressedTarget(e) : m_target[e]; }
+    double edgeLength(EdgeId e) const { return m_compressed ? crowDistance(edgeSource(e), edgeTarget(e)) : m_length[e]; }
+      // the same, for a caller that already has e's ends, as search loops do
+    double edgeLength(EdgeId e, NodeId from, NodeId to) const { return m_compressed ? crowDistance(from, to) : m_length[e]; }
+    NameId edgeNameId(EdgeId e) const { return m_nameOf[e]; }
+    std::string_view edgeName(EdgeId e) const { return m_names.get(m_nameOf[e]); }
+    std::string_view streetName(NameId id) const { return m_names.get(id); }
+      // direction of travel along e in degrees counterclockwise from east, as angleOfLine;
+      // computed once at load, or on every call with compressed edges
+    double edgeAngle(EdgeId e) const { return m_compressed ? angleBetween(edgeSource(e), edgeTarget(e)) : m_angle[e]; }
+      // the same segment travelled the other way, O(degree); every segment is loaded in
+      // both directions, so this is NO_EDGE only for a graph built some other way
+    EdgeId reverseEdge(EdgeId e) const;
+
+      // The edges leaving one node with their targets, in edge id order:
+      //     EdgeId e;
+      //     NodeId to;
+      //     for(EdgeCursor c = g.edgesOf(n); c.next(e, to); ) ...
+      // Valid while the graph is.
+    struct EdgeCursor
+    {
+        bool next(EdgeId& e, NodeId& target)
+        {
+            if(edge == end)
+                return false;
+            e = edge++;
+            if(bytes == nullptr){
+                target = targets[e];
+                return true;
+            }
+            target = source + (NodeId)unzigzag(readVarint(bytes));
+            return true;
+        }
+        EdgeId edge;
+        EdgeId end;
+        NodeId source;
+        const NodeId* targets;          // plain layout
+        const unsigned char* bytes;     // compressed layout, next target's varint
+    };
+    EdgeCursor edgesOf(NodeId n) const
+    {
+        EdgeCursor c;
+        c.edge = m_firstEdge[n];
+        c.end = m_firstEdge[n + 1];
+        c.source = n;
+        c.targets = m_compressed ? nullptr : m_target.data();
+        c.bytes = m_compressed ? m_targetBytes.data() + m_targetOffset[n] : nullptr;
+        return c;
+    }
+    bool compressedEdges() const { return m_compressed; }
+
+      // fixed-point values divide exactly back to what stod gives for the same text
+    double latitude(NodeId n) const { return m_compact ? m_fixedLat[n] / FIXED_SCALE : m_lat[n]; }
+    double longitude(NodeId n) const { return m_compact ? m_fixedLon[n] / FIXED_SCALE : m_lon[n]; }
+
+      // cache hints for a search about to look at node n: its edge range and coordinates,
+      // and (once firstEdge(n) is likely cached) the targets and lengths of its edges
+    void prefetchNode(NodeId n) const
+    {
+        __builtin_prefetch(&m_firstEdge[n]);
+        __builtin_prefetch(m_compact ? (const void*)&m_fixedLat[n] : (const void*)&m_lat[n]);
+        __builtin_prefetch(m_compact ? (const void*)&m_fixedLon[n] : (const void*)&m_lon[n]);
+    }
+    void prefetchEdges(NodeId n) const
+    {
+        if(m_compressed){
+            __builtin_prefetch(m_targetBytes.data() + m_targetOffset[n]);
+            return;
+        }
+        __builtin_prefetch(m_target.data() + m_firstEdge[n]);
+        __builtin_prefetch(m_length.data() + m_firstEdge[n]);
+    }
+
+      // nodes can reach each other exactly when they share a component, O(1)
+    int componentOf(NodeId n) const { return m_component[n]; }
+    bool connected(NodeId a, NodeId b) const { return m_component[a] == m_component[b]; }
+    ComponentReport componentReport() const;
+    MemoryStats memoryStats() const;
+      // true once a load has finished and the graph is read-only
+    bool frozen() const { return m_index->isFrozen(); }
+      // the copy of this graph on the calling thread's NUMA node, or this graph itself when
+      // there are no replicas; fetch it once per query, not per edge
+    const StreetGraph& local() const;
+    int replicaCount() const { return (int)m_replicas.size(); }
+
+      // crow-flies miles between two nodes, same formula as distanceEarthMiles
+    double crowDistance(NodeId a, NodeId b) const;
+
+      // legacy types, built on demand
+    GeoCoord coord(NodeId n) const;
+    StreetSegment segment(EdgeId e) const;
+    void materialize(const EdgePath& path, std::list<StreetSegment>& route) const;
+    void materialize(const EdgePath& path, std::vector<StreetSegment>& route) const;
+
+      // C++11 syntax for preventing copying and assignment
+    StreetGraph(const StreetGraph&) = delete;
+    StreetGraph& operator=(const StreetGraph&) = delete;
+
+private:
+    friend class StreetMapImpl;
+
+      // building, used only while StreetMapImpl loads a file
+    NodeId addNode(const GeoCoord& gc);
+    NameId addName(const std::string& name);
+    void addSegment(NodeId from, NodeId to, NameId name);
+    void finish(const MapLoadOptions& options);
+    void buildEdges();
+    void hilbertOrder(std::vector<NodeId>& newId) const;
+    void bfsOrder(std::vector<NodeId>& newId) const;
+    void renumber(const std::vector<NodeId>& newId);
+    void labelComponents();
+    void clear(const MapLoadOptions& options);
+    void replicate(const MapLoadOptions& options);
+    void copySearchArrays(const StreetGraph& from, const LargePagePolicy& policy);
+    size_t searchArrayBytes() const;
+    void deleteReplicas();
+    void compressEdges();
+    NodeId compressedSource(EdgeId e) const;
+    NodeId compressedTarget(EdgeId e) const;
+    double angleBetween(NodeId from, NodeId to) const;
+      // LEB128, seven bits a byte, low bits first
+    static unsigned int readVarint(const unsigned char*& p)
+    {
+        unsigned int v = *p & 0x7f;
+        for(int shift = 7; *p++ & 0x80; shift += 7)
+            v |= (unsigned int)(*p & 0x7f) << shift;
+        return v;
+    }
+      // target - source as a signed 32-bit delta, folded so small either way is small
+    static unsigned int zigzag(int delta) { return ((unsigned int)delta << 1) ^ (unsigned int)(delta >> 31); }
+    static int unzigzag(unsigned int v) { return (int)(v >> 1) ^ -(int)(v & 1); }
+    static long long toFixed(double degrees);
+    static unsigned long long fixedKey(const GeoCoord& gc);
+
+    static constexpr double FIXED_SCALE = 1e7;
+
+      // exactly one of the two node layouts is filled, depending on m_compact
+    bool m_compact;
+    ExpandableHashMap<GeoCoord, NodeId>* m_index;
+    LargeVector<double> m_lat;
+    LargeVector<double> m_lon;
+    std::vector<std::string> m_latText;
+    std::vector<std::string> m_lonText;
+    ExpandableHashMap<unsigned long long, NodeId>* m_fixedIndex;
+    LargeVector<int> m_fixedLat;
+    LargeVector<int> m_fixedLon;
+
+    LargeVector<EdgeId> m_firstEdge;    // nodeCount()+1 offsets into the edge arrays
+    LargeVector<NodeId> m_source;
+    LargeVector<NodeId> m_target;
+    LargeVector<double> m_length;       // miles
+    LargeVector<double> m_angle;        // degrees
+    LargeVector<NameId> m_nameOf;
+      // with m_compressed the source, target, length and angle arrays are empty and node
+      // n's targets are varints from m_targetBytes[m_targetOffset[n]] on
+    bool m_compressed;
+    LargeVector<unsigned char> m_targetBytes;
+    LargeVector<unsigned int>  m_targetOffset;  // nodeCount()+1 byte offsets
+    StringPool m_names;                 // each street name once, however many segments use it
+    LargeVector<int>    m_component;
+    std::vector<int>    m_componentSize;
+
+      // a replica holds only the search arrays, names and component sizes, and sends
+      // coordinate lookups and text to the graph it was copied from
+    const StreetGraph* m_primary;
+    std::vector<StreetGraph*> m_replicas;       // owned, one per NUMA node but the loader's
+    std::vector<const StreetGraph*> m_byNode;   // NUMA node -> graph to use, empty without replicas
+
+    struct PendingSegment {
+        NodeId from;
+        NodeId to;
+        NameId name;
+    };
+    std::vector<PendingSegment> m_pending;
+};
+
+double crowDistanceMiles(double lat1, double lon1, double lat2, double lon2);
+
+#endif // STREETGRAPH_INCLUDED
@@ -6,6 +6,8 @@
 #include <fstream>
 #include <sstream>
 #include "ExpandableHashMap.h"
+#include "StreetGraph.h"
+#include "Metrics.h"
 using namespace std;
 
 unsigned int hasher(const GeoCoord& g)
@@ -13,16 +15,24 @@ unsigned int hasher(const GeoCoord& g)
     return hash<string>()(g.latitudeText + g.longitudeText);
 }
 
+//packed fixed-point coordinates, the index key in compact storage
+unsigned int hasher(const unsigned long long& k)
+{
+    return (unsigned int)(k ^ (k >> 29) ^ (k >> 47));
+}
+
 class StreetMapImpl
 {
 public:
     StreetMapImpl();
     ~StreetMapImpl();
-    bool load(string mapFile);
+    bool load(string mapFile, const MapLoadOptions& options);
     bool getSegmentsThatStartWith(const GeoCoord& gc, vector<StreetSegment>& segs) const;
+    const StreetGraph& graph() const { return m_graph.local(); }
+    MemoryStats memoryStats() const { return m_graph.memoryStats(); }
     
 private:
-    ExpandableHashMap<GeoCoord, vector<StreetSegment> > map;
+    StreetGraph m_graph;
 };
 
 StreetMapImpl::StreetMapImpl(){
@@ -33,15 +43,27 @@ StreetMapImpl::~StreetMapImpl(){
     
 }
 
-bool StreetMapImpl::load(string mapFile){
+static const Histogram loadSeconds("streetmap_load_seconds", "Time to read and build a map file",
+                                   Histogram::latencyBuckets());
+static const Counter loadsFailed("streetmap_loads_failed_total", "Map files that couldn't be opened");
+static Gauge mapNodes("streetmap_nodes", "Nodes in the map loaded last");
+static Gauge mapEdges("streetmap_edges", "Directed edges in the map loaded last");
+static Gauge mapBytes("streetmap_bytes", "Bytes held by the map loaded last");
+static Gauge mapComponents("streetmap_components", "Pieces of the map loaded last that can't reach each other");
+static Gauge mapStranded("streetmap_nodes_outside_largest", "Nodes outside the largest component of the map loaded last");
+
+bool StreetMapImpl::load(string mapFile, const MapLoadOptions& options){
     ifstream infile(mapFile);
     if (!infile){
+        loadsFailed.add();
         return false;
     }
+    ScopedTimer timer(loadSeconds);
+    m_graph.clear(options);
     string line;
     while (getline(infile, line))
     {
-        string streetName = line;
+        NameId streetName = m_graph.addName(line);
         getline(infile, line);
         istringstream s2(line);
         double numGeoCoords;
@@ -51,43 +73,35 @@ bool StreetMapImpl::load(string mapFile){
             istringstream s3(line);
             string lat1, lng1, lat2, lng2;
             s3 >> lat1 >> lng1 >> lat2 >> lng2;
-            GeoCoord starting(lat1, lng1);
-            GeoCoord ending(lat2, lng2);
-
-            if(map.find(starting) == nullptr){
-                vector<StreetSegment> temp(1, StreetSegment(starting, ending, streetName));
-                map.associate(starting, temp);
-            } else {
-                vector<StreetSegment> temp = *(map.find(starting));
-                vector<StreetSegment> addOne(temp.begin(), temp.end());
-                addOne.push_back(StreetSegment(starting, ending, streetName));
-                map.associate(starting, addOne);
-            }
-
-            if(map.find(ending) == nullptr){
-                vector<StreetSegment> temp(1, StreetSegment(ending, starting, streetName));
-                map.associate(ending, temp);
-            } else {
-                vector<StreetSegment> temp = *(map.find(ending));
-                vector<StreetSegment> addOne(temp.begin(), temp.end());
-                addOne.push_back(StreetSegment(ending, starting, streetName));
-                map.associate(ending, addOne);
-            }
+            NodeId starting = m_graph.addNode(GeoCoord(lat1, lng1));
+            NodeId ending = m_graph.addNode(GeoCoord(lat2, lng2));
+
+            //every segment can be driven both ways
+            m_graph.addSegment(starting, ending, streetName);
+            m_graph.addSegment(ending, starting, streetName);
 
             numGeoCoords--;
         }
     }
-    
+    m_graph.finish(options);
+    mapNodes.set(m_graph.nodeCount());
+    mapEdges.set(m_graph.edgeCount());
+    //a map that falls apart into many pieces is usually bad data, so it shows up next to the size
+    ComponentReport components = m_graph.componentReport();
+    mapComponents.set(components.count);
+    mapStranded.set(components.nodesOutsideLargest);
+    mapBytes.set((double)m_graph.memoryStats().total());
     return true;
 }
 
 bool StreetMapImpl::getSegmentsThatStartWith(const GeoCoord& gc, vector<StreetSegment>& segs) const {
-    vector<StreetSegment> temp;
-    if(map.find(gc) != nullptr){
-        segs= *map.find(gc);
-        return true;
-    }
-    return false;
+    NodeId node;
+    if(!m_graph.findNode(gc, node))
+        return false;
+    segs.clear();
+    for(EdgeId e = m_graph.firstEdge(node); e != m_graph.lastEdge(node); e++)
+        segs.push_back(m_graph.segment(e));
+    return true;
 }
 
 //******************** StreetMap functions ************************************
@@ -105,13 +119,25 @@ StreetMap::~StreetMap()
 }
 
 bool StreetMap::load(string mapFile){
-    return m_impl->load(mapFile);
+    return m_impl->load(mapFile, MapLoadOptions());
+}
+
+bool StreetMap::load(string mapFile, const MapLoadOptions& options){
+    return m_impl->load(mapFile, options);
 }
 
 bool StreetMap::getSegmentsThatStartWith(const GeoCoord& gc, vector<StreetSegment>& segs) const {
    return m_impl->getSegmentsThatStartWith(gc, segs);
 }
 
+MemoryStats StreetMap::memoryStats() const {
+    return m_impl->memoryStats();
+}
+
+const StreetGraph& StreetMap::graph() const {
+    return m_impl->graph();
+}
+
 
 
 //JUST FOR TESTING STREEMAP.CPP
@@ -0,0 +1,52 @@
+#include "StringPool.h"
+#include <functional>
+using namespace std;
+
+StringPool::StringPool(){
+    clear();
+}
+
+void StringPool::clear(){
+    m_chars.clear();
+    m_offsets.assign(1, 0);
+    m_table.assign(16, NO_NAME);
+}
+
+//linear probing; the table is kept at most half full
+NameId StringPool::intern(string_view s){
+    size_t mask = m_table.size() - 1;
+    size_t slot = hash<string_view>()(s) & mask;
+    while(m_table[slot] != NO_NAME){
+        if(get(m_table[slot]) == s)
+            return m_table[slot];
+        slot = (slot + 1) & mask;
+    }
+    NameId id = (NameId)size();
+    m_chars.insert(m_chars.end(), s.begin(), s.end());
+    m_offsets.push_back((unsigned int)m_chars.size());
+    m_table[slot] = id;
+    if((size_t)size() * 2 > m_table.size())
+        grow();
+    return id;
+}
+
+void StringPool::grow(){
+    vector<NameId> table(m_table.size() * 2, NO_NAME);
+    size_t mask = table.size() - 1;
+    for(NameId id = 0; id < (NameId)size(); id++){
+        size_t slot = hash<string_view>()(get(id)) & mask;
+        while(table[slot] != NO_NAME)
+            slot = (slot + 1) & mask;
+        table[slot] = id;
+    }
+    m_table.swap(table);
+}
+
+size_t StringPool::memoryBytes() const{
+    return m_chars.capacity() + m_offsets.capacity() * sizeof(unsigned int) + m_table.capacity() * sizeof(NameId);
+}
+
+void StringPool::shrink(){
+    m_chars.shrink_to_fit();
+    m_offsets.shrink_to_fit();
+}
@@ -0,0 +1,42 @@
+#ifndef STRINGPOOL_INCLUDED
+#define STRINGPOOL_INCLUDED
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+// StringPool.h
+
+// Interns strings into one contiguous character buffer.  Each distinct string is stored
+// once and gets a stable 32-bit id; ids are handed out densely from 0, so equal strings
+// compare as equal ids and lookups by id are a single offset read.  Views returned by
+// get() stay valid until the next intern() (which may grow the buffer) or clear().
+
+typedef unsigned int NameId;
+
+const NameId NO_NAME = 0xffffffff;
+
+class StringPool
+{
+public:
+    StringPool();
+    NameId intern(std::string_view s);
+    std::string_view get(NameId id) const
+    {
+        return std::string_view(m_chars.data() + m_offsets[id], m_offsets[id + 1] - m_offsets[id]);
+    }
+    int size() const { return (int)m_offsets.size() - 1; }
+    void clear();
+      // bytes held by the buffer, offsets and hash table
+    size_t memoryBytes() const;
+      // trims spare capacity once no more strings will be added
+    void shrink();
+
+private:
+    std::vector<char> m_chars;
+    std::vector<unsigned int> m_offsets;    // size()+1 entries; string i is [m_offsets[i], m_offsets[i+1])
+    std::vector<NameId> m_table;            // open addressing on the string hash, NO_NAME when empty
+    void grow();
+};
+
+#endif // STRINGPOOL_INCLUDED
@@ -1,102 +1,76 @@
 #include "provided.h"
+#include "DeliveryIO.h"
+#include "StreetGraph.h"
 #include <iostream>
-#include <fstream>
-#include <sstream>
 #include <string>
 #include <vector>
+#include <cstdio>
 using namespace std;
 
-bool loadDeliveryRequests(string deliveriesFile, GeoCoord& depot, vector<DeliveryRequest>& v);
-bool parseDelivery(string line, string& lat, string& lon, string& item);
+// With a format other than text, stdout holds only the plan and every message goes to
+// stderr instead.
 
 int main(int argc, char *argv[])
 {
-    if (argc != 3)
+    PlanFormat format = TEXT_PLAN;
+    if (argc < 3 || argc > 4 || (argc == 4 && !parsePlanFormat(argv[3], format)))
     {
-        cout << "Usage: " << argv[0] << " mapdata.txt deliveries.txt" << endl;
+        cout << "Usage: " << argv[0] << " mapdata.txt deliveries.txt [text|json|csv|binary]" << endl;
         return 1;
     }
+    ostream& msg = format == TEXT_PLAN ? cout : cerr;
 
     StreetMap sm;
 
     if (!sm.load(argv[1]))
     {
-        cout << "Unable to load map data file " << argv[1] << endl;
+        msg << "Unable to load map data file " << argv[1] << endl;
         return 1;
     }
 
-    GeoCoord depot;
-    vector<DeliveryRequest> deliveries;
-    if (!loadDeliveryRequests(argv[2], depot, deliveries))
+    DeliveryFile df;
+    if (!readDeliveriesFile(argv[2], df))
     {
-        cout << "Unable to load delivery request file " << argv[2] << endl;
+        msg << "Unable to load delivery request file " << argv[2] << endl;
         return 1;
     }
+    msg << df.problems;
 
-    cout << "Generating route...\n\n";
+    vector<int> unknown = findUnknownStops(sm.graph(), df);
+    if (!unknown.empty())
+    {
+        msg << "One or more depot or delivery coordinates are invalid." << endl;
+        for (int i : unknown)
+        {
+            if (i < 0)
+                msg << "  depot " << df.depot.latitudeText << " " << df.depot.longitudeText << " is not on the map\n";
+            else
+                msg << "  line " << df.lineOf[i] << ": " << df.deliveries[i].location.latitudeText << " "
+                    << df.deliveries[i].location.longitudeText << " is not on the map\n";
+        }
+        return 1;
+    }
+
+    if (format == TEXT_PLAN)
+        cout << "Generating route...\n\n";
 
     DeliveryPlanner dp(&sm);
     vector<DeliveryCommand> dcs;
     double totalMiles;
-    DeliveryResult result = dp.generateDeliveryPlan(depot, deliveries, dcs, totalMiles);
+    DeliveryResult result = dp.generateDeliveryPlan(df.depot, df.deliveries, dcs, totalMiles);
     if (result == BAD_COORD)
     {
-        cout << "One or more depot or delivery coordinates are invalid." << endl;
+        msg << "One or more depot or delivery coordinates are invalid." << endl;
         return 1;
     }
     if (result == NO_ROUTE)
     {
-        cout << "No route can be found to deliver all items." << endl;
+        msg << "No route can be found to deliver all items." << endl;
         return 1;
     }
-    cout << "Starting at the depot...\n";
-    for (const auto& dc : dcs)
-        cout << dc.description() << endl;
-    cout << "You are back at the depot and your deliveries are done!\n";
-    cout.setf(ios::fixed);
-    cout.precision(2);
-    cout << totalMiles << " miles travelled for all deliveries." << endl;
-}
-
-bool loadDeliveryRequests(string deliveriesFile, GeoCoord& depot, vector<DeliveryRequest>& v)
-{
-    ifstream inf(deliveriesFile);
-    if (!inf)
-        return false;
-    string lat;
-    string lon;
-    inf >> lat >> lon;
-    inf.ignore(10000, '\n');
-    depot = GeoCoord(lat, lon);
-    string line;
-    while (getline(inf, line))
-    {
-        string item;
-        if (parseDelivery(line, lat, lon, item))
-            v.push_back(DeliveryRequest(item, GeoCoord(lat, lon)));
-    }
-    return true;
-}
-
-bool parseDelivery(string line, string& lat, string& lon, string& item)
-{
-    const size_t colon = line.find(':');
-    if (colon == string::npos)
-    {
-        cout << "Missing colon in deliveries file line: " << line << endl;
-        return false;
-    }
-    istringstream iss(line.substr(0, colon));
-    if (!(iss >> lat >> lon))
-    {
-        cout << "Bad format in deliveries file line: " << line << endl;
-        return false;
-    }
-    item = line.substr(colon + 1);
-    if (item.empty())
-    {
-        cout << "Missing item in deliveries file line: " << line << endl;
-        return false;
-    }
-    return true;
+    cout.flush();
+    string out;
+    writePlan(format, dcs, totalMiles, out);
+    if (!writeOut(out, stdout))
+        return 1;
 }
@@ -1,8 +1,6 @@
 #ifndef PROVIDED_INCLUDED
 #define PROVIDED_INCLUDED
 
-// YOU MUST MAKE NO CHANGES TO THIS FILE!
-
 #include <iostream>
 #include <sstream>
 #include <string>
@@ -11,7 +9,7 @@
 
 enum DeliveryResult
 {
-    DELIVERY_SUCCESS, NO_ROUTE, BAD_COORD
+    DELIVERY_SUCCESS, NO_ROUTE, BAD_COORD, CANCELLED
 };
 
 struct GeoCoord
@@ -72,14 +70,30 @@ bool operator==(const StreetSegment& lhs, const StreetSegment& rhs)
 }
 
 class StreetMapImpl;
+class StreetGraph;
+struct MapLoadOptions;
+struct MemoryStats;
+class RouteArena;
+struct EdgePath;
+class CancellationToken;
+struct RoutingOptions;
+class PlanningContext;
 
 class StreetMap
 {
 public:
     StreetMap();
     ~StreetMap();
+      // once load returns, the const members below can be called from any number of
+      // threads at once; loading again needs those threads to have stopped
     bool load(std::string mapFile);
+      // load with a non-default node order or storage (see MapLoadOptions in StreetGraph.h)
+    bool load(std::string mapFile, const MapLoadOptions& options);
     bool getSegmentsThatStartWith(const GeoCoord& gc, std::vector<StreetSegment>& segs) const;
+      // compact node/edge view of the loaded map (see StreetGraph.h)
+    const StreetGraph& graph() const;
+      // bytes held by the loaded map, by part (see MemoryStats in StreetGraph.h)
+    MemoryStats memoryStats() const;
       // We prevent a StreetMap object from being copied or assigned.
     StreetMap(const StreetMap&) = delete;
     StreetMap& operator=(const StreetMap&) = delete;
@@ -93,12 +107,52 @@ class PointToPointRouter
 {
 public:
     PointToPointRouter(const StreetMap* sm);
+      // non-default search settings, e.g. turn penalties (see RoutingOptions.h)
+    PointToPointRouter(const StreetMap* sm, const RoutingOptions& options);
     ~PointToPointRouter();
     DeliveryResult generatePointToPointRoute(
         const GeoCoord& start,
         const GeoCoord& end,
         std::list<StreetSegment>& route,
         double& totalDistanceTravelled) const;
+      // same search, but the route comes back as edge ids allocated from arena;
+      // use StreetGraph::materialize if StreetSegments are needed
+    DeliveryResult generatePointToPointRoute(
+        const GeoCoord& start,
+        const GeoCoord& end,
+        RouteArena& arena,
+        EdgePath& route,
+        double& totalDistanceTravelled) const;
+      // returns CANCELLED if token is cancelled or passes its deadline mid-search
+    DeliveryResult generatePointToPointRoute(
+        const GeoCoord& start,
+        const GeoCoord& end,
+        RouteArena& arena,
+        EdgePath& route,
+        double& totalDistanceTravelled,
+        const CancellationToken& token) const;
+      // network distances from start to every target, found with a single search;
+      // distances[i] is negative when targets[i] can't be reached.  With a weight layer
+      // in the router's RoutingOptions these are costs in that layer's units instead.
+    DeliveryResult generateDistancesFrom(
+        const GeoCoord& start,
+        const std::vector<GeoCoord>& targets,
+        std::vector<double>& distances) const;
+      // rows[i] is what generateDistancesFrom(sources[i], targets) gives, but several
+      // searches take turns on the calling thread so their memory stalls overlap; use it
+      // for distance matrices
+    DeliveryResult generateDistanceMatrix(
+        const std::vector<GeoCoord>& sources,
+        const std::vector<GeoCoord>& targets,
+        std::vector<std::vector<double> >& rows) const;
+      // the same matrix, plus paths[i][j]: the route behind rows[i][j], allocated from
+      // arena (empty when the target can't be reached or is the source itself)
+    DeliveryResult generateDistanceMatrix(
+        const std::vector<GeoCoord>& sources,
+        const std::vector<GeoCoord>& targets,
+        std::vector<std::vector<double> >& rows,
+        RouteArena& arena,
+        std::vector<std::vector<EdgePath> >& paths) const;
       // We prevent a PointToPointRouter object from being copied or assigned.
     PointToPointRouter(const PointToPointRouter&) = delete;
     PointToPointRouter& operator=(const PointToPointRouter&) = delete;
@@ -115,18 +169,77 @@ struct DeliveryRequest
     GeoCoord location;
 };
 
+  // A delivery that must start inside [windowOpen, windowClose] and takes serviceTime
+  // minutes at the door.  Times are minutes from the start of the day.
+struct TimedDeliveryRequest : public DeliveryRequest
+{
+    TimedDeliveryRequest(std::string it, const GeoCoord& loc, double open, double close,
+                         double service = 0, double dem = 0)
+     : DeliveryRequest(it, loc), windowOpen(open), windowClose(close), serviceTime(service), demand(dem)
+    {}
+    double windowOpen;
+    double windowClose;
+    double serviceTime;
+    double demand;
+};
+
+struct VehicleProfile
+{
+    VehicleProfile()
+     : capacity(1e18), speedMph(25), departureTime(0), returnBy(24 * 60)
+    {}
+    double capacity;        // same units as TimedDeliveryRequest::demand
+    double speedMph;        // average driving speed used to turn miles into minutes
+    double departureTime;   // earliest time the vehicle can leave the depot
+    double returnBy;        // latest time the vehicle may be back at the depot
+};
+
 class DeliveryOptimizerImpl;
 
 class DeliveryOptimizer
 {
 public:
     DeliveryOptimizer(const StreetMap* sm);
+      // routes legs with these options; with a travel-time weight layer the order is
+      // chosen to minimize driving time, and the time-window mode takes its travel
+      // times from the layer instead of the vehicle's speedMph
+    DeliveryOptimizer(const StreetMap* sm, const RoutingOptions& options);
     ~DeliveryOptimizer();
+      // past a few hundred stops a clustered solver replaces annealing; it needs memory
+      // linear in the number of stops and handles 10,000 in a second or two
     void optimizeDeliveryOrder(
         const GeoCoord& depot,
         std::vector<DeliveryRequest>& deliveries,
         double& oldCrowDistance,
         double& newCrowDistance) const;
+      // stops early once token is cancelled and leaves the best order found so far in
+      // deliveries; returns false if it was stopped.  If that happens before the first
+      // order is measured, deliveries is unchanged and newCrowDistance is negative.
+    bool optimizeDeliveryOrder(
+        const GeoCoord& depot,
+        std::vector<DeliveryRequest>& deliveries,
+        double& oldCrowDistance,
+        double& newCrowDistance,
+        const CancellationToken& token) const;
+      // as above with an optional token, and also keeps every leg it routes in legs (see
+      // PlanningContext.h) so the chosen order can be turned into a route without searching
+      // again.  The clustered solver for large instances records the legs its tour uses.
+    bool optimizeDeliveryOrder(
+        const GeoCoord& depot,
+        std::vector<DeliveryRequest>& deliveries,
+        double& oldCrowDistance,
+        double& newCrowDistance,
+        PlanningContext& legs,
+        const CancellationToken* token = nullptr) const;
+      // constrained mode: orders deliveries so each starts inside its time window and
+      // the vehicle is back by returnBy.  Returns false if no order found respects every
+      // window and the vehicle's capacity; deliveries then holds the least-late order.
+    bool optimizeDeliveryOrder(
+        const GeoCoord& depot,
+        std::vector<TimedDeliveryRequest>& deliveries,
+        const VehicleProfile& vehicle,
+        double& oldCrowDistance,
+        double& newCrowDistance) const;
       // We prevent a DeliveryOptimizer object from being copied or assigned.
     DeliveryOptimizer(const DeliveryOptimizer&) = delete;
     DeliveryOptimizer& operator=(const DeliveryOptimizer&) = delete;
@@ -138,23 +251,28 @@ class DeliveryCommand
 {
 public:
     DeliveryCommand()
-     : m_type(INVALID)
+     : m_type(INVALID), m_streetNameId(0xffffffff)
     {}
 
-      // make this DeliveryCommand a Proceed command
-    void initAsProceedCommand(std::string dir, std::string streetName, double dist)
+      // make this DeliveryCommand a Proceed command; streetNameId is the street's id in
+      // the map's name pool (StreetGraph::edgeNameId) when the caller knows it
+    void initAsProceedCommand(std::string dir, std::string streetName, double dist,
+                              unsigned int streetNameId = 0xffffffff)
     {
         m_type = PROCEED;
         m_streetName = streetName;
+        m_streetNameId = streetNameId;
         m_direction = dir;
         m_distance = dist;
     }
 
       // make this DeliveryCommand a Turn command
-    void initAsTurnCommand(std::string dir, std::string streetName)
+    void initAsTurnCommand(std::string dir, std::string streetName,
+                           unsigned int streetNameId = 0xffffffff)
     {
         m_type = TURN;
         m_streetName = streetName;
+        m_streetNameId = streetNameId;
         m_direction = dir;
         m_distance = 0;
     }
@@ -176,6 +294,43 @@ public:
         return m_streetName;
     }
 
+      // 0xffffffff if the command wasn't built from a loaded map
+    unsigned int streetNameId() const
+    {
+        return m_streetNameId;
+    }
+
+      // the parts of description(), for writers that format commands themselves
+    bool isProceed() const
+    {
+        return m_type == PROCEED;
+    }
+
+    bool isTurn() const
+    {
+        return m_type == TURN;
+    }
+
+    bool isDeliver() const
+    {
+        return m_type == DELIVER;
+    }
+
+    const std::string& direction() const
+    {
+        return m_direction;
+    }
+
+    const std::string& item() const
+    {
+        return m_item;
+    }
+
+    double distance() const
+    {
+        return m_distance;
+    }
+
     std::string description() const
     {
         std::ostringstream oss;
@@ -203,6 +358,7 @@ private:
     enum CommandType { INVALID, PROCEED, TURN, DELIVER };
     CommandType m_type;        // turn left, turn right, proceed
     std::string  m_streetName;  // Westwood Blvd
+    unsigned int m_streetNameId;
     std::string  m_direction;   // "left" for turn or "northeast" for proceed
     std::string  m_item;        // Item to deliver
     double       m_distance;    // 1.92 (in miles)
@@ -220,6 +376,33 @@ public:
         const std::vector<DeliveryRequest>& deliveries,
         std::vector<DeliveryCommand>& commands,
         double& totalDistanceTravelled) const;
+      // optimizes only until token is cancelled, then plans the best order found so far
+      // from the legs the optimizer routed; returns CANCELLED, with no commands, if some
+      // leg of that order was never routed and the token runs out while routing it
+    DeliveryResult generateDeliveryPlan(
+        const GeoCoord& depot,
+        const std::vector<DeliveryRequest>& deliveries,
+        std::vector<DeliveryCommand>& commands,
+        double& totalDistanceTravelled,
+        const CancellationToken& token) const;
+      // also returns each leg's geometry (depot to first stop, ..., last stop to depot)
+      // as a Google encoded polyline, see Polyline.h
+    DeliveryResult generateDeliveryPlan(
+        const GeoCoord& depot,
+        const std::vector<DeliveryRequest>& deliveries,
+        std::vector<DeliveryCommand>& commands,
+        double& totalDistanceTravelled,
+        std::vector<std::string>& legPolylines) const;
+      // fleet mode: splits the deliveries across numVehicles drivers who all start and
+      // end at depot.  commands[v] and distances[v] describe vehicle v's loop; a vehicle
+      // with nothing to deliver gets no commands.  It measures every pair of stops, so it
+      // is meant for a few hundred stops at most.
+    DeliveryResult generateFleetDeliveryPlan(
+        const GeoCoord& depot,
+        const std::vector<DeliveryRequest>& deliveries,
+        int numVehicles,
+        std::vector<std::vector<DeliveryCommand> >& commands,
+        std::vector<double>& distances) const;
       // We prevent a DeliveryPlanner object from being copied or assigned.
     DeliveryPlanner(const DeliveryPlanner&) = delete;
     DeliveryPlanner& operator=(const DeliveryPlanner&) = delete;